@@ -0,0 +1,311 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+
+#include "raii.hpp"
+#include "vulkan.hpp"
+
+namespace vk {
+
+namespace detail {
+
+constexpr VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// One VkDeviceMemory carved up first-fit from a free list of (offset -> size) ranges that are coalesced on free.
+struct MemoryBlock {
+  MemoryBlock(VkDevice device, VkDeviceSize size, uint32_t memoryType, bool hostVisible)
+      : memory{device, size, memoryType},
+        size{size},
+        mapped{hostVisible ? memory.map() : nullptr},
+        free_{{VkDeviceSize{0}, size}} {}
+
+  std::optional<VkDeviceSize> allocate(VkDeviceSize bytes, VkDeviceSize alignment) {
+    for (auto it = free_.begin(); it != free_.end(); ++it) {
+      auto [start, length] = *it;
+      auto offset = alignUp(start, alignment);
+      if (offset + bytes > start + length) {
+        continue;
+      }
+      free_.erase(it);
+      if (offset > start) {
+        free_.emplace(start, offset - start);
+      }
+      if (offset + bytes < start + length) {
+        free_.emplace(offset + bytes, start + length - offset - bytes);
+      }
+      used += bytes;
+      allocations++;
+      return offset;
+    }
+    return std::nullopt;
+  }
+
+  void free(VkDeviceSize offset, VkDeviceSize bytes) {
+    auto it = free_.emplace(offset, bytes).first;
+    if (auto next = std::next(it); next != free_.end() && it->first + it->second == next->first) {
+      it->second += next->second;
+      free_.erase(next);
+    }
+    if (it != free_.begin()) {
+      if (auto prev = std::prev(it); prev->first + prev->second == it->first) {
+        prev->second += it->second;
+        free_.erase(it);
+      }
+    }
+    used -= bytes;
+    allocations--;
+  }
+
+  size_t freeRanges() const {
+    return free_.size();
+  }
+
+  VkDeviceSize largestFreeRange() const {
+    VkDeviceSize largest{};
+    for (auto const& [offset, length] : free_) {
+      largest = std::max(largest, length);
+    }
+    return largest;
+  }
+
+  DeviceMemory memory;
+  VkDeviceSize const size;
+  void* const mapped;  // null unless the memory type is host visible
+  VkDeviceSize used{};
+  size_t allocations{};
+
+ private:
+  std::map<VkDeviceSize, VkDeviceSize> free_;
+};
+
+}  // namespace detail
+
+// A sub-range of one of the Allocator's blocks, returned to it on destruction. The Allocator must outlive it.
+struct Allocation : raii::UniqueHandle<Allocation, detail::MemoryBlock*> {
+  Allocation() = default;
+
+  VkDeviceMemory memory() const {
+    return block()->memory;
+  }
+
+  VkDeviceSize offset() const {
+    return offset_;
+  }
+
+  VkDeviceSize size() const {
+    return size_;
+  }
+
+  // Persistently mapped pointer to the start of the allocation, or null if it isn't host visible.
+  void* mapped() const {
+    return block()->mapped ? static_cast<char*>(block()->mapped) + offset_ : nullptr;
+  }
+
+ private:
+  friend struct Allocator;
+  friend UniqueHandle<Allocation, detail::MemoryBlock*>;
+
+  Allocation(detail::MemoryBlock* block, VkDeviceSize offset, VkDeviceSize size)
+      : UniqueHandle{block}, offset_{offset}, size_{size} {}
+
+  detail::MemoryBlock* block() const {
+    return *this;
+  }
+
+  void destroy(detail::MemoryBlock* block) {
+    block->free(offset_, size_);
+  }
+
+  VkDeviceSize offset_{};
+  VkDeviceSize size_{};
+};
+
+// Sub-allocates buffers and images out of a few large VkDeviceMemory blocks per memory type instead of one allocation
+// per resource, which keeps us far from maxMemoryAllocationCount and off the driver's allocation path. Blocks are
+// never returned to the driver before the Allocator itself is destroyed. Not thread-safe.
+struct Allocator {
+  static constexpr VkDeviceSize kDefaultBlockSize{VkDeviceSize{64} << 20};
+
+  struct HeapStats {
+    VkDeviceSize heapSize{};
+    VkDeviceSize blockBytes{};  // obtained from the driver
+    VkDeviceSize usedBytes{};   // handed out to allocations
+    VkDeviceSize largestFreeRange{};
+    size_t blocks{};
+    size_t allocations{};
+    size_t freeRanges{};
+  };
+
+  explicit Allocator(Device const& device, VkDeviceSize blockSize = kDefaultBlockSize)
+      : device_{device},
+        memProps_{device.physicalDeviceInfo().memoryProperties},
+        // linear and optimal-tiling resources share blocks, so keep every allocation granularity-aligned rather than
+        // tracking which kind of resource sits next to which
+        granularity_{device.physicalDeviceInfo().properties.limits.bufferImageGranularity},
+        blockSize_{blockSize},
+        blocks_(memProps_.memoryTypeCount) {}
+
+  Allocation allocate(VkMemoryRequirements const& requirements, VkMemoryPropertyFlags properties) {
+    auto type = memoryType(requirements.memoryTypeBits, properties);
+    auto alignment = std::max(requirements.alignment, granularity_);
+    auto bytes = detail::alignUp(requirements.size, granularity_);
+
+    auto& blocks = blocks_[type];
+    for (auto const& block : blocks) {
+      if (auto offset = block->allocate(bytes, alignment)) {
+        return Allocation{block.get(), *offset, bytes};
+      }
+    }
+
+    // anything bigger than a block gets a block of its own
+    auto hostVisible = (memProps_.memoryTypes[type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+    auto const& block = blocks.emplace_back(
+        std::make_unique<detail::MemoryBlock>(device_, std::max(preferredBlockSize(type), bytes), type, hostVisible));
+    return Allocation{block.get(), *block->allocate(bytes, alignment), bytes};
+  }
+
+  // Allocates memory for a Buffer or Image and binds it.
+  template <typename Resource> Allocation allocateAndBind(Resource const& resource, VkMemoryPropertyFlags properties) {
+    auto allocation = allocate(resource.memoryRequirements(), properties);
+    resource.bind(allocation.memory(), allocation.offset());
+    return allocation;
+  }
+
+  VkDevice device() const {
+    return device_;
+  }
+
+  // Whether allocate() would find a memory type with `properties` for `requirements`, e.g. to fall back from
+  // LAZILY_ALLOCATED on GPUs that don't have it.
+  bool supports(VkMemoryRequirements const& requirements, VkMemoryPropertyFlags properties) const {
+    return findMemoryType(requirements.memoryTypeBits, properties).has_value();
+  }
+
+  std::vector<HeapStats> stats() const {
+    std::vector<HeapStats> heaps(memProps_.memoryHeapCount);
+    for (uint32_t i{}; i < memProps_.memoryHeapCount; i++) {
+      heaps[i].heapSize = memProps_.memoryHeaps[i].size;
+    }
+    for (uint32_t type{}; type < blocks_.size(); type++) {
+      auto& heap = heaps[memProps_.memoryTypes[type].heapIndex];
+      for (auto const& block : blocks_[type]) {
+        heap.blockBytes += block->size;
+        heap.usedBytes += block->used;
+        heap.largestFreeRange = std::max(heap.largestFreeRange, block->largestFreeRange());
+        heap.blocks++;
+        heap.allocations += block->allocations;
+        heap.freeRanges += block->freeRanges();
+      }
+    }
+    return heaps;
+  }
+
+  // Fragmentation is the share of free block space that isn't in the single largest free range.
+  void report(std::ostream& out) const {
+    out << "heap      size MiB  blocks MiB    used MiB  blocks  allocs  free ranges  fragmentation\n";
+    auto heaps = stats();
+    for (size_t i{}; i < heaps.size(); i++) {
+      auto const& h = heaps[i];
+      auto freeBytes = h.blockBytes - h.usedBytes;
+      auto fragmentation = freeBytes ? 1.0 - static_cast<double>(h.largestFreeRange) / freeBytes : 0.0;
+      out << std::left << std::setw(4) << i << std::right << std::fixed << std::setprecision(1) << std::setw(12)
+          << h.heapSize / 1048576.0 << std::setw(12) << h.blockBytes / 1048576.0 << std::setw(12)
+          << h.usedBytes / 1048576.0 << std::setw(8) << h.blocks << std::setw(8) << h.allocations << std::setw(13)
+          << h.freeRanges << std::setw(14) << fragmentation * 100 << "%\n";
+    }
+  }
+
+ private:
+  std::optional<uint32_t> findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties) const {
+    for (uint32_t i{}; i < memProps_.memoryTypeCount; i++) {
+      if ((typeBits & (1u << i)) && (memProps_.memoryTypes[i].propertyFlags & properties) == properties) {
+        return i;
+      }
+    }
+    return std::nullopt;
+  }
+
+  uint32_t memoryType(uint32_t typeBits, VkMemoryPropertyFlags properties) const {
+    if (auto type = findMemoryType(typeBits, properties)) {
+      return *type;
+    }
+    throw std::runtime_error{"no suitable memory type"};
+  }
+
+  // small heaps (e.g. the 256 MiB host-visible device-local window) get proportionally smaller blocks
+  VkDeviceSize preferredBlockSize(uint32_t type) const {
+    auto heapSize = memProps_.memoryHeaps[memProps_.memoryTypes[type].heapIndex].size;
+    return heapSize <= (VkDeviceSize{1} << 30) ? std::min(blockSize_, heapSize / 8) : blockSize_;
+  }
+
+  VkDevice device_;
+  VkPhysicalDeviceMemoryProperties memProps_;
+  VkDeviceSize granularity_;
+  VkDeviceSize blockSize_;
+  std::vector<std::vector<std::unique_ptr<detail::MemoryBlock>>> blocks_;  // indexed by memory type
+};
+
+// Bump allocator over a single buffer for data that only lives for one frame (uniforms, staging, ...). Keep one per
+// frame slot and reset it once that slot's previous frame has completed; reset is free and nothing is ever freed
+// individually.
+struct LinearArena {
+  struct Slice {
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    void* mapped;  // null unless the arena's memory is host visible
+  };
+
+  LinearArena(
+      Allocator& allocator,
+      VkDeviceSize capacity,
+      VkBufferUsageFlags usage,
+      VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+      : buffer_{allocator.device(), capacity, usage},
+        allocation_{allocator.allocateAndBind(buffer_, properties)},
+        capacity_{capacity} {}
+
+  Slice push(VkDeviceSize size, VkDeviceSize alignment = 1) {
+    auto offset = detail::alignUp(head_, alignment);
+    if (offset + size > capacity_) {
+      throw std::runtime_error{"linear arena exhausted"};
+    }
+    head_ = offset + size;
+    auto base = static_cast<char*>(allocation_.mapped());
+    return Slice{buffer_, offset, size, base ? base + offset : nullptr};
+  }
+
+  void reset() {
+    head_ = 0;
+  }
+
+  VkDeviceSize used() const {
+    return head_;
+  }
+
+  VkDeviceSize capacity() const {
+    return capacity_;
+  }
+
+  VkBuffer buffer() const {
+    return buffer_;
+  }
+
+ private:
+  Buffer buffer_;
+  Allocation allocation_;
+  VkDeviceSize capacity_;
+  VkDeviceSize head_{};
+};
+
+}  // namespace vk
\ No newline at end of file
@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "options.hpp"
+#include "profiler.hpp"
+#include "shell.hpp"
+
+// Runs vulkan-tinker headless once for every combination of the swept settings and collects each run's --json output
+// into one document, so that results can be compared across commits and GPUs and plotted against any one setting.
+// Every run is its own process, so each starts from a fresh device and none inherits another's allocations or caches
+// (apart from the pipeline cache on disk, which only shortens start-up).
+
+#ifndef VULKAN_TINKER_EXECUTABLE
+#  define VULKAN_TINKER_EXECUTABLE "vulkan-tinker"
+#endif
+
+namespace {
+
+// One vulkan-tinker option and the values to sweep it over. No values leaves it at vulkan-tinker's default.
+struct Axis {
+  char const* flag;
+  std::vector<std::string> values;
+};
+
+struct Options {
+  std::filesystem::path executable{VULKAN_TINKER_EXECUTABLE};
+  std::optional<std::filesystem::path> out;  // stdout if not given
+  std::string label;                         // recorded with the results, e.g. a commit or a driver version
+  uint64_t warmupFrames{100};
+  uint64_t frames{1000};
+  std::vector<Axis> axes{
+      {"--instances", {}},
+      {"--draws", {}},
+      {"--triangles", {}},
+      {"--msaa", {}},
+      {"--frames-in-flight", {}},
+      {"--record-threads", {}},
+  };
+  std::vector<std::string> passThrough;  // everything after --, given to every run as is
+};
+
+// A comma-separated list of numbers, kept as text since it is only ever handed on to vulkan-tinker.
+std::vector<std::string> parseList(std::string_view arg, std::string_view text) {
+  std::vector<std::string> values;
+  while (true) {
+    auto comma = text.find(',');
+    auto value = text.substr(0, comma);
+    cli::parseNumber<uint32_t>(arg, value);
+    values.emplace_back(value);
+    if (comma == std::string_view::npos) {
+      return values;
+    }
+    text.remove_prefix(comma + 1);
+  }
+}
+
+Options parse(int argc, char** argv) {
+  Options options;
+  for (int i{1}; i < argc; i++) {
+    std::string_view arg{argv[i]};
+    auto value = [&] {
+      if (++i >= argc) {
+        throw std::runtime_error{"missing value for " + std::string{arg}};
+      }
+      return std::string_view{argv[i]};
+    };
+
+    if (arg == "--") {
+      options.passThrough.assign(argv + i + 1, argv + argc);
+      break;
+    } else if (arg == "--vulkan-tinker") {
+      options.executable = value();
+    } else if (arg == "--out") {
+      options.out = value();
+    } else if (arg == "--label") {
+      options.label = value();
+    } else if (arg == "--warmup-frames") {
+      options.warmupFrames = cli::parseNumber<uint64_t>(arg, value());
+    } else if (arg == "--frames") {
+      options.frames = cli::parseNumber<uint64_t>(arg, value());
+      if (options.frames == 0) {
+        throw std::runtime_error{"--frames must be at least 1"};
+      }
+    } else if (auto axis = std::ranges::find(options.axes, arg, &Axis::flag); axis != options.axes.end()) {
+      axis->values = parseList(arg, value());
+    } else {
+      throw std::runtime_error{"unknown argument " + std::string{arg}};
+    }
+  }
+  return options;
+}
+
+// Runs `args` and returns what it wrote to `json`. vulkan-tinker's own report goes nowhere, leaving stdout to the
+// results and stderr to progress and errors.
+std::string run(std::vector<std::string> const& args, std::filesystem::path const& json) {
+  std::string command;
+  for (auto const& arg : args) {
+    command += shell::quote(arg) + ' ';
+  }
+  command += "--json " + shell::quote(json.string());
+#ifdef _WIN32
+  command += " > NUL";
+#else
+  command += " > /dev/null";
+#endif
+  if (auto status = shell::run(command); status != 0) {
+    throw std::runtime_error{"run failed with status " + std::to_string(status) + ": " + command};
+  }
+  std::ifstream in{json};
+  if (!in) {
+    throw std::runtime_error{"run wrote no results: " + command};
+  }
+  std::string result{std::istreambuf_iterator<char>{in}, {}};
+  in.close();
+  std::filesystem::remove(json);
+  while (!result.empty() && (result.back() == '\n' || result.back() == '\r')) {
+    result.pop_back();
+  }
+  return result;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  try {
+    auto options = parse(argc, argv);
+
+    // every combination of the swept values, counted through like an odometer with the last axis turning fastest
+    std::vector<Axis const*> swept;
+    size_t runCount{1};
+    for (auto const& axis : options.axes) {
+      if (!axis.values.empty()) {
+        swept.push_back(&axis);
+        runCount *= axis.values.size();
+      }
+    }
+
+    auto const json = std::filesystem::temp_directory_path() /
+                      ("vulkan-tinker-bench-" + std::to_string(std::random_device{}()) + ".json");
+    std::ostringstream results;
+    results << "{\"label\":";
+    prof::writeJsonString(results, options.label);
+    results << ",\"runs\":[";
+
+    std::vector<size_t> position(swept.size());
+    for (size_t runIdx{}; runIdx < runCount; runIdx++) {
+      std::vector<std::string> args{
+          options.executable.string(),
+          "--headless",
+          // Debug builds validate by default, which would be timed along with everything else
+          "--validation",
+          "off",
+          "--warmup-frames",
+          std::to_string(options.warmupFrames),
+          "--frames",
+          std::to_string(options.frames),
+      };
+      std::string description;
+      for (size_t i{}; i < swept.size(); i++) {
+        args.emplace_back(swept[i]->flag);
+        args.push_back(swept[i]->values[position[i]]);
+        description += ' ' + args[args.size() - 2] + ' ' + args.back();
+      }
+      args.insert(args.end(), options.passThrough.cbegin(), options.passThrough.cend());
+      std::cerr << '[' << runIdx + 1 << '/' << runCount << ']' << description << std::endl;
+
+      results << (runIdx ? "," : "") << '\n' << run(args, json);
+
+      for (auto i = swept.size(); i-- > 0;) {
+        if (++position[i] < swept[i]->values.size()) {
+          break;
+        }
+        position[i] = 0;
+      }
+    }
+    results << "\n]}\n";
+
+    if (options.out) {
+      std::ofstream out{*options.out};
+      out.exceptions(std::ios::failbit | std::ios::badbit);
+      out << results.str();
+    } else {
+      std::cout << results.str();
+    }
+  } catch (std::exception const& e) {
+    std::cerr << "vulkan-tinker-bench: " << e.what() << '\n';
+    return 1;
+  }
+  return 0;
+}
\ No newline at end of file
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <stop_token>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "vulkan.hpp"
+
+namespace vk {
+
+// A pool of threads that builds pipelines (or anything else slow to create) off the render thread. Jobs run in the
+// order they were submitted and hand their result, or the exception they threw, back through a future. Pipeline
+// caches are internally synchronized, so jobs can all compile into the same one. Destroying the pool finishes the job
+// each thread is on and drops the rest, whose futures then report a broken promise.
+struct PipelineCompiler {
+  // One thread fewer than the machine has, so the render thread keeps a core to itself.
+  static uint32_t defaultThreadCount() {
+    return std::clamp(std::thread::hardware_concurrency(), 2u, 5u) - 1;
+  }
+
+  explicit PipelineCompiler(uint32_t threadCount = defaultThreadCount()) {
+    if (threadCount == 0) {
+      throw std::runtime_error{"need at least one compiler thread"};
+    }
+    for (uint32_t i{}; i < threadCount; i++) {
+      threads_.emplace_back([this](std::stop_token stop) { run(stop); });
+    }
+  }
+
+  PipelineCompiler(PipelineCompiler const&) = delete;
+  PipelineCompiler& operator=(PipelineCompiler const&) = delete;
+
+  // Queues `build` and returns its eventual result. Everything it refers to must outlive the job.
+  template <typename Build> std::future<std::invoke_result_t<Build>> submit(Build build) {
+    using Result = std::invoke_result_t<Build>;
+    // std::function needs something copyable, and packaged_task isn't
+    auto task = std::make_shared<std::packaged_task<Result()>>(std::move(build));
+    auto result = task->get_future();
+    {
+      std::lock_guard lock{mutex_};
+      queue_.emplace_back([task] { (*task)(); });
+    }
+    ready_.notify_one();
+    return result;
+  }
+
+ private:
+  void run(std::stop_token stop) {
+    while (true) {
+      std::unique_lock lock{mutex_};
+      // the wait returns whether there is a job, even once stopped, so a stop has to be checked for separately. the
+      // jobs left in the queue are destroyed with it, breaking their promises
+      if (!ready_.wait(lock, stop, [&] { return !queue_.empty(); }) || stop.stop_requested()) {
+        return;
+      }
+      auto job = std::move(queue_.front());
+      queue_.pop_front();
+      lock.unlock();
+      // packaged_task stores any exception in the future, so nothing escapes here
+      job();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable_any ready_;
+  std::deque<std::function<void()>> queue_;
+  std::vector<std::jthread> threads_;  // last, so they stop before anything they use is destroyed
+};
+
+// Graphics pipelines built on a PipelineCompiler, one per distinct PipelineDesc: asking for a desc that is already
+// built, or still building, returns the same pipeline rather than compiling another, so any number of users that agree
+// on their state share one VkPipeline. A pipeline lives as long as someone holds its Handle; the library itself only
+// remembers the ones that are still held. Only for use from one thread.
+struct PipelineLibrary {
+  using Handle = std::shared_ptr<std::shared_future<Pipeline> const>;
+
+  PipelineLibrary(VkDevice device, VkPipelineCache cache, PipelineCompiler& compiler)
+      : device_{device}, cache_{cache}, compiler_{compiler} {}
+
+  PipelineLibrary(PipelineLibrary const&) = delete;
+  PipelineLibrary& operator=(PipelineLibrary const&) = delete;
+
+  // The desc is copied into the job, shader modules included, so nothing needs to outlive it but the layout and, if
+  // there is one, the render pass.
+  Handle get(PipelineDesc const& desc) {
+    // a forgotten desc still owns its shader modules, so they are let go of on every call rather than only on misses
+    std::erase_if(pipelines_, [](auto const& entry) { return entry.second.expired(); });
+    if (auto it = pipelines_.find(desc); it != pipelines_.end()) {
+      return it->second.lock();
+    }
+    auto handle = std::make_shared<std::shared_future<Pipeline> const>(
+        compiler_.submit([device = device_, cache = cache_, desc] { return Pipeline{device, cache, desc}; }).share());
+    pipelines_.insert_or_assign(desc, handle);
+    return handle;
+  }
+
+  // Distinct pipelines currently held by someone.
+  size_t size() const {
+    return static_cast<size_t>(
+        std::ranges::count_if(pipelines_, [](auto const& entry) { return !entry.second.expired(); }));
+  }
+
+ private:
+  VkDevice device_;
+  VkPipelineCache cache_;
+  PipelineCompiler& compiler_;
+  std::unordered_map<PipelineDesc, std::weak_ptr<std::shared_future<Pipeline> const>> pipelines_;
+};
+
+}  // namespace vk
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace shaders {
+
+// The SPIR-V for `name` (e.g. "main.vert.spv") if the build embedded it in the binary, otherwise empty. CMake's
+// VULKAN_TINKER_EMBED_SHADERS option has glslc write each shader as a list of words, included here directly.
+inline std::span<uint32_t const> embedded(std::string_view name) {
+#ifdef VULKAN_TINKER_EMBED_SHADERS
+  static constexpr uint32_t kMainVert[]{
+#include "main.vert.inc"
+  };
+  static constexpr uint32_t kMainFrag[]{
+#include "main.frag.inc"
+  };
+  static constexpr uint32_t kCullComp[]{
+#include "cull.comp.inc"
+  };
+  if (name == "main.vert.spv") {
+    return kMainVert;
+  }
+  if (name == "main.frag.spv") {
+    return kMainFrag;
+  }
+  if (name == "cull.comp.spv") {
+    return kCullComp;
+  }
+#else
+  (void)name;
+#endif
+  return {};
+}
+
+}  // namespace shaders
\ No newline at end of file
@@ -0,0 +1,410 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+namespace vk {
+
+// Host memory for the driver's own use, handed out through VkAllocationCallbacks so it can be measured. The driver only
+// says which scope an allocation is for, so every object type gets callbacks of its own (see `callbacks`) and the
+// allocations made through them are counted against it. Requests of up to kMaxPooled bytes come from power-of-two size
+// classes carved out of chunks, with one arena per VkSystemAllocationScope so that short-lived command allocations
+// don't fragment the memory that objects hold on to, and each thread caches a few free blocks of every class so that
+// most allocations and frees never take a lock. Larger or more strictly aligned requests go to operator new.
+//
+// There is one per process, because a thread's cached blocks must stay valid until the thread exits. Wrappers only use
+// it once `install` has been called; objects created before that stay on the driver's allocator, which is fine as long
+// as it's called before the instance is created. Chunks are only returned at exit. A thread that outlives the
+// allocator, such as a driver thread that exits after static destruction, just drops its cache; one that allocates or
+// frees through it by then is beyond saving, so every object must be destroyed before main returns.
+struct HostAllocator {
+  static constexpr size_t kScopes{VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1};
+  static constexpr size_t kMinPooled{16};
+  static constexpr size_t kMaxPooled{4096};
+  static constexpr size_t kClasses = std::countr_zero(kMaxPooled) - std::countr_zero(kMinPooled) + 1;
+  static constexpr size_t kChunkSize{64 << 10};
+  static constexpr size_t kThreadCacheDepth{32};  // free blocks a thread keeps per scope and class
+
+  struct Usage {
+    uint64_t bytes{};  // live, as requested by the driver
+    uint64_t peakBytes{};
+    uint64_t allocations{};    // made in total, reallocations included
+    uint64_t live{};           // not yet freed
+    uint64_t internalBytes{};  // live memory the driver allocated itself and only told us about
+  };
+
+  struct Stats {
+    std::map<VkObjectType, Usage> types;
+    std::array<Usage, kScopes> scopes;
+    uint64_t pooledBytes{};  // obtained for the size classes
+  };
+
+  static HostAllocator& get() {
+    static HostAllocator allocator;
+    return allocator;
+  }
+
+  HostAllocator(HostAllocator const&) = delete;
+  HostAllocator& operator=(HostAllocator const&) = delete;
+
+  ~HostAllocator() {
+    destroyed_.store(true, std::memory_order_release);
+    for (auto& arena : arenas_) {
+      for (auto chunk : arena.chunks) {
+        ::operator delete(chunk, std::align_val_t{sizeof(Header)});
+      }
+    }
+  }
+
+  void install() {
+    installed_.store(true, std::memory_order_relaxed);
+  }
+
+  // What to create an object of `type` with, and so destroy it with too; null until installed.
+  VkAllocationCallbacks const* callbacks(VkObjectType type) {
+    if (!installed_.load(std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    std::lock_guard lock{typesMutex_};
+    auto [it, inserted] = types_.try_emplace(type);
+    if (inserted) {
+      it->second.callbacks = VkAllocationCallbacks{
+          .pUserData = &it->second,
+          .pfnAllocation = &allocation,
+          .pfnReallocation = &reallocation,
+          .pfnFree = &deallocation,
+          .pfnInternalAllocation = &internalAllocation,
+          .pfnInternalFree = &internalFree,
+      };
+    }
+    return &it->second.callbacks;
+  }
+
+  Stats stats() const {
+    Stats stats;
+    {
+      std::lock_guard lock{typesMutex_};
+      for (auto const& [type, entry] : types_) {
+        stats.types.emplace(type, entry.usage.snapshot());
+      }
+    }
+    for (size_t i{}; i < kScopes; i++) {
+      stats.scopes[i] = scopes_[i].snapshot();
+    }
+    stats.pooledBytes = pooledBytes_.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+  void report(std::ostream& out) const {
+    auto const s = stats();
+    auto row = [&](char const* name, Usage const& u) {
+      out << std::left << std::setw(22) << name << std::right << std::fixed << std::setprecision(1) << std::setw(10)
+          << u.bytes / 1024.0 << std::setw(10) << u.peakBytes / 1024.0 << std::setw(8) << u.live << std::setw(10)
+          << u.allocations << std::setw(14) << u.internalBytes / 1024.0 << '\n';
+    };
+    out << "host memory             live KiB  peak KiB    live    allocs  internal KiB\n";
+    for (auto const& [type, usage] : s.types) {
+      row(objectTypeName(type), usage);
+    }
+    constexpr std::array<char const*, kScopes> scopeNames{
+        "scope command", "scope object", "scope cache", "scope device", "scope instance"};
+    for (size_t i{}; i < kScopes; i++) {
+      row(scopeNames[i], s.scopes[i]);
+    }
+    out << "pooled " << std::fixed << std::setprecision(1) << s.pooledBytes / 1024.0 << " KiB in " << kClasses
+        << " size classes\n";
+  }
+
+ private:
+  // Precedes every block handed to the driver, which the free callback gets no size or scope with.
+  struct alignas(16) Header {
+    size_t size;
+    uint32_t alignment;  // of a block from operator new; 0 for a pooled one
+    uint8_t sizeClass;
+    uint8_t scope;
+  };
+  static_assert(sizeof(Header) == 16);
+
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  struct Counters {
+    void add(size_t size) {
+      auto const now = bytes.fetch_add(size, std::memory_order_relaxed) + size;
+      for (auto peak = peakBytes.load(std::memory_order_relaxed);
+           now > peak && !peakBytes.compare_exchange_weak(peak, now, std::memory_order_relaxed);) {
+      }
+      allocations.fetch_add(1, std::memory_order_relaxed);
+      live.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void remove(size_t size) {
+      bytes.fetch_sub(size, std::memory_order_relaxed);
+      live.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    Usage snapshot() const {
+      return Usage{
+          .bytes = bytes.load(std::memory_order_relaxed),
+          .peakBytes = peakBytes.load(std::memory_order_relaxed),
+          .allocations = allocations.load(std::memory_order_relaxed),
+          .live = live.load(std::memory_order_relaxed),
+          .internalBytes = internalBytes.load(std::memory_order_relaxed),
+      };
+    }
+
+    std::atomic<uint64_t> bytes{};
+    std::atomic<uint64_t> peakBytes{};
+    std::atomic<uint64_t> allocations{};
+    std::atomic<uint64_t> live{};
+    std::atomic<uint64_t> internalBytes{};
+  };
+
+  struct TypeEntry {
+    VkAllocationCallbacks callbacks{};
+    Counters usage;
+  };
+
+  struct Arena {
+    std::mutex mutex;
+    std::array<FreeBlock*, kClasses> free{};
+    std::vector<void*> chunks;
+  };
+
+  struct ThreadCache {
+    struct List {
+      FreeBlock* head{};
+      size_t count{};
+    };
+
+    ~ThreadCache() {
+      // get() would touch a destroyed static; the cached blocks went with its chunks anyway
+      if (destroyed_.load(std::memory_order_acquire)) {
+        return;
+      }
+      for (size_t scope{}; scope < kScopes; scope++) {
+        for (size_t sizeClass{}; sizeClass < kClasses; sizeClass++) {
+          get().giveBack(scope, sizeClass, lists[scope][sizeClass], lists[scope][sizeClass].count);
+        }
+      }
+    }
+
+    std::array<std::array<List, kClasses>, kScopes> lists{};
+  };
+
+  HostAllocator() = default;
+
+  static ThreadCache& threadCache() {
+    thread_local ThreadCache cache;
+    return cache;
+  }
+
+  static constexpr size_t classBytes(size_t sizeClass) {
+    return kMinPooled << sizeClass;
+  }
+
+  static constexpr size_t sizeClassOf(size_t size) {
+    return static_cast<size_t>(std::bit_width((std::max(size, kMinPooled) - 1) / kMinPooled));
+  }
+
+  static Header& header(void* memory) {
+    return *(static_cast<Header*>(memory) - 1);
+  }
+
+  void* allocate(TypeEntry& type, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+    void* memory{};
+    if (size <= kMaxPooled && alignment <= sizeof(Header)) {
+      auto const sizeClass = sizeClassOf(size);
+      auto& list = threadCache().lists[scope][sizeClass];
+      if (!list.head) {
+        refill(scope, sizeClass, list);
+      }
+      auto* block = std::exchange(list.head, list.head->next);
+      list.count--;
+      new (block) Header{.size = size, .alignment = 0, .sizeClass = static_cast<uint8_t>(sizeClass)};
+      memory = reinterpret_cast<Header*>(block) + 1;
+    } else {
+      // the header sits just before the block, so keep the block aligned by padding with a whole alignment's worth
+      alignment = std::max(alignment, sizeof(Header));
+      auto* raw = static_cast<std::byte*>(::operator new(alignment + size, std::align_val_t{alignment}));
+      memory = raw + alignment;
+      new (&header(memory)) Header{.size = size, .alignment = static_cast<uint32_t>(alignment)};
+    }
+    header(memory).scope = static_cast<uint8_t>(scope);
+    type.usage.add(size);
+    scopes_[scope].add(size);
+    return memory;
+  }
+
+  void release(TypeEntry& type, void* memory) {
+    // copied out, since a pooled block's header is about to become a FreeBlock
+    auto const [size, alignment, sizeClass, scope] = header(memory);
+    type.usage.remove(size);
+    scopes_[scope].remove(size);
+    if (alignment) {
+      ::operator delete(static_cast<std::byte*>(memory) - alignment, std::align_val_t{alignment});
+      return;
+    }
+    auto& list = threadCache().lists[scope][sizeClass];
+    auto* block = new (&header(memory)) FreeBlock{};
+    block->next = std::exchange(list.head, block);
+    if (++list.count > kThreadCacheDepth) {
+      giveBack(scope, sizeClass, list, kThreadCacheDepth / 2);
+    }
+  }
+
+  // Moves half a cache's worth of free blocks from the arena to `list`, carving a new chunk if the arena has none.
+  void refill(size_t scope, size_t sizeClass, ThreadCache::List& list) {
+    auto& arena = arenas_[scope];
+    std::lock_guard lock{arena.mutex};
+    auto& head = arena.free[sizeClass];
+    if (!head) {
+      auto const blockBytes = sizeof(Header) + classBytes(sizeClass);
+      auto* chunk = static_cast<std::byte*>(::operator new(kChunkSize, std::align_val_t{sizeof(Header)}));
+      arena.chunks.push_back(chunk);
+      pooledBytes_.fetch_add(kChunkSize, std::memory_order_relaxed);
+      for (auto offset = kChunkSize / blockBytes * blockBytes; offset != 0;) {
+        offset -= blockBytes;
+        auto* block = reinterpret_cast<FreeBlock*>(chunk + offset);
+        block->next = std::exchange(head, block);
+      }
+    }
+    for (size_t i{}; i < kThreadCacheDepth / 2 && head; i++) {
+      auto* block = std::exchange(head, head->next);
+      block->next = std::exchange(list.head, block);
+      list.count++;
+    }
+  }
+
+  void giveBack(size_t scope, size_t sizeClass, ThreadCache::List& list, size_t count) {
+    if (count == 0) {
+      return;
+    }
+    auto& arena = arenas_[scope];
+    std::lock_guard lock{arena.mutex};
+    for (size_t i{}; i < count && list.head; i++) {
+      auto* block = std::exchange(list.head, list.head->next);
+      block->next = std::exchange(arena.free[sizeClass], block);
+      list.count--;
+    }
+  }
+
+  // The callbacks can't let exceptions out into the driver; a failed allocation is reported as null instead.
+  static void* VKAPI_PTR allocation(void* user, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+    try {
+      return get().allocate(*static_cast<TypeEntry*>(user), size, alignment, scope);
+    } catch (...) {
+      return nullptr;
+    }
+  }
+
+  static void* VKAPI_PTR reallocation(
+      void* user, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+    if (!original) {
+      return allocation(user, size, alignment, scope);
+    }
+    if (size == 0) {
+      deallocation(user, original);
+      return nullptr;
+    }
+    auto* moved = allocation(user, size, alignment, scope);
+    if (moved) {
+      std::memcpy(moved, original, std::min(size, header(original).size));
+      deallocation(user, original);
+    }
+    return moved;
+  }
+
+  static void VKAPI_PTR deallocation(void* user, void* memory) {
+    if (memory) {
+      get().release(*static_cast<TypeEntry*>(user), memory);
+    }
+  }
+
+  static void VKAPI_PTR
+  internalAllocation(void* user, size_t size, VkInternalAllocationType, VkSystemAllocationScope scope) {
+    static_cast<TypeEntry*>(user)->usage.internalBytes.fetch_add(size, std::memory_order_relaxed);
+    get().scopes_[scope].internalBytes.fetch_add(size, std::memory_order_relaxed);
+  }
+
+  static void VKAPI_PTR internalFree(void* user, size_t size, VkInternalAllocationType, VkSystemAllocationScope scope) {
+    static_cast<TypeEntry*>(user)->usage.internalBytes.fetch_sub(size, std::memory_order_relaxed);
+    get().scopes_[scope].internalBytes.fetch_sub(size, std::memory_order_relaxed);
+  }
+
+  static char const* objectTypeName(VkObjectType type) {
+    switch (type) {
+      case VK_OBJECT_TYPE_INSTANCE:
+        return "instance";
+      case VK_OBJECT_TYPE_DEVICE:
+        return "device";
+      case VK_OBJECT_TYPE_SEMAPHORE:
+        return "semaphore";
+      case VK_OBJECT_TYPE_FENCE:
+        return "fence";
+      case VK_OBJECT_TYPE_DEVICE_MEMORY:
+        return "device memory";
+      case VK_OBJECT_TYPE_BUFFER:
+        return "buffer";
+      case VK_OBJECT_TYPE_IMAGE:
+        return "image";
+      case VK_OBJECT_TYPE_QUERY_POOL:
+        return "query pool";
+      case VK_OBJECT_TYPE_IMAGE_VIEW:
+        return "image view";
+      case VK_OBJECT_TYPE_SHADER_MODULE:
+        return "shader module";
+      case VK_OBJECT_TYPE_PIPELINE_CACHE:
+        return "pipeline cache";
+      case VK_OBJECT_TYPE_PIPELINE_LAYOUT:
+        return "pipeline layout";
+      case VK_OBJECT_TYPE_RENDER_PASS:
+        return "render pass";
+      case VK_OBJECT_TYPE_PIPELINE:
+        return "pipeline";
+      case VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT:
+        return "descriptor set layout";
+      case VK_OBJECT_TYPE_SAMPLER:
+        return "sampler";
+      case VK_OBJECT_TYPE_DESCRIPTOR_POOL:
+        return "descriptor pool";
+      case VK_OBJECT_TYPE_FRAMEBUFFER:
+        return "framebuffer";
+      case VK_OBJECT_TYPE_COMMAND_POOL:
+        return "command pool";
+      case VK_OBJECT_TYPE_SURFACE_KHR:
+        return "surface";
+      case VK_OBJECT_TYPE_SWAPCHAIN_KHR:
+        return "swapchain";
+      case VK_OBJECT_TYPE_DEBUG_UTILS_MESSENGER_EXT:
+        return "debug messenger";
+      default:
+        return "other";
+    }
+  }
+
+  std::atomic<bool> installed_{};
+  mutable std::mutex typesMutex_;
+  std::map<VkObjectType, TypeEntry> types_;  // nodes don't move, so the callbacks' user data stays valid
+  std::array<Counters, kScopes> scopes_;
+  std::array<Arena, kScopes> arenas_;
+  static inline constinit std::atomic<bool> destroyed_{};  // trivially destructible, so still readable after exit
+  std::atomic<uint64_t> pooledBytes_{};
+};
+
+}  // namespace vk
\ No newline at end of file
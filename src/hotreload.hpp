@@ -0,0 +1,103 @@
+#pragma once
+
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "compiler.hpp"
+#include "shell.hpp"
+
+#ifndef VULKAN_TINKER_GLSLC
+#define VULKAN_TINKER_GLSLC "glslc"
+#endif
+
+namespace vk {
+
+// Watches GLSL sources and recompiles each one that changes into the SPIR-V the program loads (`main.frag` into
+// `main.frag.spv` and so on), so shaders can be edited while it runs. Modification times are checked at most every
+// kInterval, and glslc runs on `compiler`'s threads. It writes to a temporary file that only replaces the SPIR-V if
+// the compile succeeds; glslc itself reports errors on stderr, and the last good SPIR-V is left in place.
+struct ShaderWatcher {
+  static constexpr std::chrono::milliseconds kInterval{250};
+
+  ShaderWatcher(
+      PipelineCompiler& compiler,
+      std::filesystem::path sourceDir,
+      std::vector<std::string> const& sources,
+      std::filesystem::path outputDir = ".")
+      : compiler_{compiler} {
+    for (auto const& source : sources) {
+      auto path = sourceDir / source;
+      auto modified = std::filesystem::last_write_time(path);
+      watched_.push_back(Watched{
+          .source = std::move(path),
+          .spirv = outputDir / (source + ".spv"),
+          .modified = modified,
+      });
+    }
+  }
+
+  // Returns the SPIR-V files rebuilt since the last call, for the caller to reload whatever was built from them.
+  std::vector<std::filesystem::path> poll() {
+    std::vector<std::filesystem::path> rebuilt;
+    for (auto& watched : watched_) {
+      if (watched.compile.valid() && watched.compile.wait_for(std::chrono::seconds{0}) == std::future_status::ready &&
+          watched.compile.get()) {
+        rebuilt.push_back(watched.spirv);
+      }
+    }
+
+    auto const now = std::chrono::steady_clock::now();
+    if (now - lastChecked_ < kInterval) {
+      return rebuilt;
+    }
+    lastChecked_ = now;
+    for (auto& watched : watched_) {
+      std::error_code error;
+      // editors often save by replacing the file, so it can briefly be missing
+      auto modified = std::filesystem::last_write_time(watched.source, error);
+      if (error || modified == watched.modified || watched.compile.valid()) {
+        continue;
+      }
+      watched.modified = modified;
+      watched.compile = compiler_.submit([source = watched.source, spirv = watched.spirv] {
+        // poll() would rethrow anything that escaped into the render loop, so every failure just keeps the old shader
+        try {
+          auto tmp = std::filesystem::path{spirv}.concat(".tmp");
+          auto command = shell::quote(VULKAN_TINKER_GLSLC) + " -o " + shell::quote(tmp.string()) + ' ' +
+                         shell::quote(source.string());
+          if (shell::run(command) != 0) {
+            std::cerr << "failed to compile " << source.string() << "; keeping the last good shader\n";
+            return false;
+          }
+          // can fail on Windows, where a file that is open or mapped can't be replaced
+          std::filesystem::rename(tmp, spirv);
+          return true;
+        } catch (std::exception const& e) {
+          std::cerr << "failed to rebuild " << spirv.string() << ": " << e.what() << "; keeping the last good shader\n";
+          return false;
+        }
+      });
+    }
+    return rebuilt;
+  }
+
+ private:
+  struct Watched {
+    std::filesystem::path source;
+    std::filesystem::path spirv;
+    std::filesystem::file_time_type modified;
+    std::future<bool> compile;  // valid while glslc runs
+  };
+
+  PipelineCompiler& compiler_;
+  std::vector<Watched> watched_;
+  std::chrono::steady_clock::time_point lastChecked_{};
+};
+
+}  // namespace vk
\ No newline at end of file
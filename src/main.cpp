@@ -1,7 +1,25 @@
 ﻿#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <memory>
 #include <ranges>
+#include <span>
 
+#include "allocator.hpp"
+#include "compiler.hpp"
+#include "embedded.hpp"
 #include "glfw.hpp"
+#include "hotreload.hpp"
+#include "options.hpp"
+#include "profiler.hpp"
+#include "recording.hpp"
+#include "upload.hpp"
 #include "vulkan.hpp"
 
 using namespace optalg;
@@ -9,151 +27,1949 @@ using namespace optalg;
 using std::views::transform;
 
 constexpr char const* kName{"Vulkan Tinker"};
+constexpr VkExtent2D kWindowExtent{1920, 1080};  // also the size of the offscreen targets when headless
+constexpr VkFormat kOffscreenFormat{VK_FORMAT_B8G8R8A8_SRGB};
+
+using FrameIndex = uint_fast8_t;
+
+// How many frames the CPU may record ahead of the GPU unless --frames-in-flight says otherwise. 2 favours latency, 3
+// favours throughput; this is deliberately independent of however many images the swapchain ends up with.
+#ifndef VULKAN_TINKER_FRAMES_IN_FLIGHT
+#  define VULKAN_TINKER_FRAMES_IN_FLIGHT 2
+#endif
+constexpr FrameIndex kDefaultFramesInFlight{VULKAN_TINKER_FRAMES_IN_FLIGHT};
+static_assert(kDefaultFramesInFlight > 0);
+
+// How long frame pacing waits for a present before giving up on it (e.g. while the window is minimised).
+constexpr uint64_t kPresentWaitTimeout{100'000'000};
+
+constexpr bool isFifo(VkPresentModeKHR mode) {
+  return mode == VK_PRESENT_MODE_FIFO_KHR || mode == VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+}
+
+// The most samples up to `requested` that colour attachments support on a device with these `limits`.
+VkSampleCountFlagBits chooseSampleCount(VkPhysicalDeviceLimits const& limits, uint32_t requested) {
+  auto const supported = limits.framebufferColorSampleCounts;
+  for (auto samples = requested; samples > 1; samples >>= 1) {
+    if (supported & samples) {
+      return static_cast<VkSampleCountFlagBits>(samples);
+    }
+  }
+  return VK_SAMPLE_COUNT_1_BIT;
+}
+
+// D32_SFLOAT for its precision, then X8_D24_UNORM_PACK32, whichever the device can render to first. Depth-only
+// formats keep barriers and views to a single aspect; D16 is always supported, so it is the last resort rather than a
+// failure.
+VkFormat chooseDepthFormat(VkPhysicalDevice physicalDevice) {
+  for (auto format : {VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32}) {
+    if (vk::getPhysicalDeviceFormatProperties(physicalDevice, format).optimalTilingFeatures &
+        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+      return format;
+    }
+  }
+  return VK_FORMAT_D16_UNORM;
+}
+
+// Instances per indirect draw, and so the granularity at which draws can be split across recording threads.
+constexpr uint32_t kInstancesPerBatch{1024};
 
 struct SynchronizedCommandBuffer {
-  SynchronizedCommandBuffer(VkDevice device, VkCommandBuffer commandBuffer)
-      : commandBuffer{commandBuffer},
-        imageAvailable{device},
-        renderFinished{device},
-        cmdBufferReady{device, VK_FENCE_CREATE_SIGNALED_BIT} {}
+  // `useFence` is only needed when the device has no timeline semaphores to track frame completion with.
+  SynchronizedCommandBuffer(VkDevice device, VkCommandBuffer commandBuffer, bool useFence)
+      : commandBuffer{commandBuffer}, imageAvailable{device} {
+    if (useFence) {
+      cmdBufferReady.emplace(device, VK_FENCE_CREATE_SIGNALED_BIT);
+    }
+  }
 
   VkCommandBuffer commandBuffer;
   vk::Semaphore imageAvailable;
-  vk::Semaphore renderFinished;
-  vk::Fence cmdBufferReady;
+  std::optional<vk::Fence> cmdBufferReady;
+  uint64_t submittedFrame{};  // frame number of the last submission from this slot
 };
 
-using FrameIndex = uint_fast8_t;
+struct Vertex {
+  std::array<float, 2> position;
+  std::array<float, 3> color;
+};
+
+// Matches Instance in cull.comp.
+struct InstanceData {
+  std::array<float, 2> offset;
+  float scale;
+  uint32_t material;  // into BindlessTable's materials
+};
+
+// Binding 0 is the mesh's vertices, binding 1 steps once per instance.
+vk::VertexInput meshVertexInput() {
+  return {
+      .bindings =
+          {
+              {
+                  .binding = 0,
+                  .stride = sizeof(Vertex),
+                  .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+              },
+              {
+                  .binding = 1,
+                  .stride = sizeof(InstanceData),
+                  .inputRate = VK_VERTEX_INPUT_RATE_INSTANCE,
+              },
+          },
+      .attributes =
+          {
+              {
+                  .location = 0,
+                  .binding = 0,
+                  .format = VK_FORMAT_R32G32_SFLOAT,
+                  .offset = offsetof(Vertex, position),
+              },
+              {
+                  .location = 1,
+                  .binding = 0,
+                  .format = VK_FORMAT_R32G32B32_SFLOAT,
+                  .offset = offsetof(Vertex, color),
+              },
+              {
+                  .location = 2,
+                  .binding = 1,
+                  .format = VK_FORMAT_R32G32_SFLOAT,
+                  .offset = offsetof(InstanceData, offset),
+              },
+              {
+                  .location = 3,
+                  .binding = 1,
+                  .format = VK_FORMAT_R32_SFLOAT,
+                  .offset = offsetof(InstanceData, scale),
+              },
+              {
+                  .location = 4,
+                  .binding = 1,
+                  .format = VK_FORMAT_R32_UINT,
+                  .offset = offsetof(InstanceData, material),
+              },
+          },
+  };
+}
+
+// The mesh: one triangle cut into `count` slivers fanning out from its top corner, so the triangle count can be varied
+// without changing how much of the screen is covered. A count of 1 is just the triangle.
+struct TriangleFan {
+  explicit TriangleFan(uint32_t count) {
+    vertices.push_back(Vertex{{0.0f, -0.5f}, {1.0f, 0.0f, 0.0f}});
+    // along the bottom edge from the right corner (green) to the left (blue)
+    for (uint32_t i{}; i <= count; i++) {
+      auto t = static_cast<float>(i) / static_cast<float>(count);
+      vertices.push_back(Vertex{{0.5f - t, 0.5f}, {0.0f, 1.0f - t, t}});
+    }
+    for (uint32_t i{}; i < count; i++) {
+      indices.insert(indices.end(), {0, static_cast<uint16_t>(i + 1), static_cast<uint16_t>(i + 2)});
+    }
+  }
+
+  std::vector<Vertex> vertices;
+  std::vector<uint16_t> indices;
+};
+
+// `count` instances tiled over the viewport in a roughly square grid; a single instance fills it like the mesh alone.
+// Instances take the `materialCount` materials in turn.
+std::vector<InstanceData> gridInstances(uint32_t count, uint32_t materialCount) {
+  auto cols = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+  auto rows = (count + cols - 1) / cols;
+  auto scale = 1.0f / static_cast<float>(std::max(cols, rows));
+  std::vector<InstanceData> instances;
+  instances.reserve(count);
+  for (uint32_t i{}; i < count; i++) {
+    instances.push_back(InstanceData{
+        .offset = {-1.0f + (static_cast<float>(i % cols) + 0.5f) * 2.0f / static_cast<float>(cols),
+                   -1.0f + (static_cast<float>(i / cols) + 0.5f) * 2.0f / static_cast<float>(rows)},
+        .scale = scale,
+        .material = i % materialCount,
+    });
+  }
+  return instances;
+}
+
+struct Mesh {
+  Mesh(
+      VkDevice device,
+      vk::Allocator& allocator,
+      vk::Uploader& uploader,
+      std::span<Vertex const> vertices,
+      std::span<uint16_t const> indices)
+      : vertices{
+            device,
+            allocator,
+            uploader,
+            std::as_bytes(vertices),
+            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+            VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+            VK_PIPELINE_STAGE_VERTEX_INPUT_BIT},
+        indices{
+            device,
+            allocator,
+            uploader,
+            std::as_bytes(indices),
+            VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+            VK_ACCESS_INDEX_READ_BIT,
+            VK_PIPELINE_STAGE_VERTEX_INPUT_BIT},
+        indexCount{static_cast<uint32_t>(indices.size())},
+        boundingSphere{[&] {
+          auto [minX, maxX] = std::ranges::minmax(vertices | transform([](auto const& v) { return v.position[0]; }));
+          auto [minY, maxY] = std::ranges::minmax(vertices | transform([](auto const& v) { return v.position[1]; }));
+          std::array center{(minX + maxX) / 2, (minY + maxY) / 2};
+          float radius{};
+          for (auto const& v : vertices) {
+            radius = std::max(radius, std::hypot(v.position[0] - center[0], v.position[1] - center[1]));
+          }
+          return std::array{center[0], center[1], 0.0f, radius};
+        }()} {}
+
+  vk::UploadedBuffer vertices;
+  vk::UploadedBuffer indices;
+  uint32_t indexCount;
+  std::array<float, 4> boundingSphere;  // xyz centre, w radius
+};
+
+// Matches the push constants in cull.comp.
+struct CullParams {
+  std::array<std::array<float, 4>, 6> planes;
+  std::array<float, 4> boundingSphere;
+  uint32_t instanceCount;
+  uint32_t batchSize;
+};
+
+// Inward-facing clip space planes; View::frustum() maps them back into the scene.
+constexpr std::array<std::array<float, 4>, 6> kClipSpaceFrustum{{
+    {1, 0, 0, 1},
+    {-1, 0, 0, 1},
+    {0, 1, 0, 1},
+    {0, -1, 0, 1},
+    {0, 0, 1, 0},
+    {0, 0, -1, 1},
+}};
+
+// Matches the push constants in main.vert: clip space is scene * scale + offset.
+struct View {
+  // Fits the [-1, 1] square the scene is laid out in to `extent` without stretching it.
+  static View fit(VkExtent2D extent) {
+    auto const side = static_cast<float>(std::min(extent.width, extent.height));
+    return View{.scale = {side / extent.width, side / extent.height}, .offset = {0, 0}};
+  }
+
+  // The clip space frustum in scene space, renormalised so the cull shader's distances stay in scene units.
+  std::array<std::array<float, 4>, 6> frustum() const {
+    std::array<std::array<float, 4>, 6> planes;
+    for (size_t i{}; i < planes.size(); i++) {
+      auto const [nx, ny, nz, d] = kClipSpaceFrustum[i];
+      std::array plane{nx * scale[0], ny * scale[1], nz, nx * offset[0] + ny * offset[1] + d};
+      auto const length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+      for (auto& v : plane) {
+        v /= length;
+      }
+      planes[i] = plane;
+    }
+    return planes;
+  }
+
+  std::array<float, 2> scale;
+  std::array<float, 2> offset;
+};
+
+// The SPIR-V built into the binary if there is any, otherwise `name` in the working directory.
+vk::ShaderModule loadShader(VkDevice device, std::string_view name) {
+  if (auto code = shaders::embedded(name); !code.empty()) {
+    return vk::ShaderModule{device, code};
+  }
+  return vk::ShaderModule{device, std::filesystem::path{name}};
+}
+
+struct CullPipeline {
+  static constexpr std::array kBindings{
+      VkDescriptorSetLayoutBinding{
+          .binding = 0,
+          .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          .descriptorCount = 1,
+          .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+      },  // all instances
+      VkDescriptorSetLayoutBinding{
+          .binding = 1,
+          .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          .descriptorCount = 1,
+          .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+      },  // visible instances
+      VkDescriptorSetLayoutBinding{
+          .binding = 2,
+          .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          .descriptorCount = 1,
+          .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+      },  // indirect commands, one per batch
+  };
+  static constexpr uint32_t kWorkgroupSize{64};
+
+  CullPipeline(VkDevice device, VkPipelineCache pipelineCache)
+      : setLayout{device, kBindings},
+        layout{
+            device,
+            std::array{static_cast<VkDescriptorSetLayout>(setLayout)},
+            std::array{VkPushConstantRange{
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                .offset = 0,
+                .size = sizeof(CullParams),
+            }}},
+        shader{loadShader(device, kShader)},
+        pipeline{device, pipelineCache, shader, layout, {{0, kWorkgroupSize}}} {}
+
+  // Rebuilds `pipeline` from the shader on disk (even in a build that embeds it, since that's where --watch-shaders
+  // writes), returning the old one for the caller to retire.
+  vk::Pipeline reload(VkDevice device, VkPipelineCache pipelineCache) {
+    shader = vk::ShaderModule{device, std::filesystem::path{kShader}};
+    return std::exchange(pipeline, vk::Pipeline{device, pipelineCache, shader, layout, {{0, kWorkgroupSize}}});
+  }
+
+  static constexpr char const* kShader{"cull.comp.spv"};
+
+  vk::DescriptorSetLayout setLayout;
+  vk::PipelineLayout layout;
+  vk::ShaderModule shader;
+  vk::Pipeline pipeline;
+};
+
+// Every instance lives in one buffer, split into fixed-size batches. Each frame the cull pass compacts the ones inside
+// the frustum into the frame slot's `visible` buffer and counts them into their batch's indirect command, so the CPU
+// cost of drawing is one call per batch (or one in all, with multiDrawIndirect) and nothing per instance. Batches exist
+// so the draws can be split across recording threads.
+struct DrawList {
+  struct Slot {
+    Slot(
+        VkDevice device,
+        vk::Allocator& allocator,
+        vk::DescriptorPool const& descriptorPool,
+        CullPipeline const& cull,
+        VkBuffer instances,
+        VkDeviceSize instancesSize,
+        uint32_t batchCount)
+        : visible{device, instancesSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT},
+          visibleMemory{allocator.allocateAndBind(visible, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)},
+          commands{
+              device,
+              batchCount * sizeof(VkDrawIndexedIndirectCommand),
+              VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                  VK_BUFFER_USAGE_TRANSFER_DST_BIT},
+          commandsMemory{allocator.allocateAndBind(commands, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)},
+          descriptorSet{descriptorPool.allocate(cull.setLayout)} {
+      vk::writeBufferDescriptors(
+          device,
+          descriptorSet,
+          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          std::array{instances, static_cast<VkBuffer>(visible), static_cast<VkBuffer>(commands)});
+    }
+
+    vk::Buffer visible;
+    vk::Allocation visibleMemory;
+    vk::Buffer commands;
+    vk::Allocation commandsMemory;
+    VkDescriptorSet descriptorSet;
+  };
+
+  DrawList(
+      VkDevice device,
+      vk::Allocator& allocator,
+      vk::Uploader& uploader,
+      vk::DescriptorPool const& descriptorPool,
+      CullPipeline const& cull,
+      Mesh const& mesh,
+      std::span<InstanceData const> instances,
+      uint32_t batchSize,
+      size_t slotCount)
+      : instances{
+            device,
+            allocator,
+            uploader,
+            std::as_bytes(instances),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_ACCESS_SHADER_READ_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT},
+        instanceCount{static_cast<uint32_t>(instances.size())},
+        batchSize{batchSize},
+        batchCount{(instanceCount + batchSize - 1) / batchSize},
+        initialCommands{
+            device,
+            allocator,
+            uploader,
+            std::as_bytes(std::span<VkDrawIndexedIndirectCommand const>{
+                std::views::iota(uint32_t{}, batchCount) | transform([&](uint32_t batch) {
+                  return VkDrawIndexedIndirectCommand{
+                      .indexCount = mesh.indexCount,
+                      .firstInstance = batch * batchSize,
+                  };
+                }) |
+                to<std::vector>()}),
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VK_ACCESS_TRANSFER_READ_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT} {
+    for (size_t i{}; i < slotCount; i++) {
+      slots.emplace_back(
+          device, allocator, descriptorPool, cull, this->instances.buffer, instances.size_bytes(), batchCount);
+    }
+  }
+
+  vk::UploadedBuffer instances;
+  uint32_t instanceCount;
+  uint32_t batchSize;
+  uint32_t batchCount;
+  vk::UploadedBuffer initialCommands;  // every batch's draw with no instances, copied over a slot's before culling
+  std::vector<Slot> slots;             // one per frame in flight
+};
+
+void recordCull(
+    VkCommandBuffer commandBuffer,
+    CullPipeline const& cull,
+    Mesh const& mesh,
+    DrawList const& drawList,
+    DrawList::Slot const& slot,
+    View const& view) {
+  // the previous frame to use this slot has completed, so only this frame's own writes need ordering
+  VkBufferCopy region{.size = drawList.batchCount * sizeof(VkDrawIndexedIndirectCommand)};
+  vkCmdCopyBuffer(commandBuffer, drawList.initialCommands.buffer, slot.commands, 1, &region);
+  vk::cmdMemoryBarrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cull.pipeline);
+  vkCmdBindDescriptorSets(
+      commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cull.layout, 0, 1, &slot.descriptorSet, 0, nullptr);
+  CullParams params{
+      .planes = view.frustum(),
+      .boundingSphere = mesh.boundingSphere,
+      .instanceCount = drawList.instanceCount,
+      .batchSize = drawList.batchSize,
+  };
+  vkCmdPushConstants(commandBuffer, cull.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), &params);
+  auto groups = (drawList.instanceCount + CullPipeline::kWorkgroupSize - 1) / CullPipeline::kWorkgroupSize;
+  vkCmdDispatch(commandBuffer, groups, 1, 1);
+
+  vk::cmdMemoryBarrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_ACCESS_SHADER_WRITE_BIT,
+      VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+      VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+}
+
+// Everything that depends only on the swapchain's format. Rebuilding these is expensive (a pipeline compile), so they
+// survive swapchain recreation unless the format itself changes. With `dynamicRendering` there is no render pass and
+// render() does the layout transitions itself, leaving the image in `finalLayout`. With more than one sample, frames
+// are drawn into a transient multisampled image and resolved into the target. With `depthPrepass`, everything is first
+// drawn depth-only by `prepass` so that `pipeline` shades only the fragments that end up visible. The pipelines come
+// from a PipelineLibrary, compiled in the background, and render() draws nothing (just clearing the target) until
+// poll() has seen them all finish. The library's descs share ownership of the shader modules, so those can be
+// replaced while compiles run.
+struct PipelineInfo {
+  using Shader = std::shared_ptr<vk::ShaderModule const>;
+
+  PipelineInfo(
+      VkDevice device,
+      vk::PipelineLibrary& library,
+      VkFormat format,
+      Shader const& vertexShader,
+      Shader const& fragmentShader,
+      VkPipelineLayout layout,
+      bool dynamicRendering,
+      VkSampleCountFlagBits samples,
+      VkFormat depthFormat,
+      bool depthPrepass,
+      VkImageLayout finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR)
+      : format{format},
+        finalLayout{finalLayout},
+        samples{samples},
+        depthFormat{depthFormat},
+        depthPrepass{depthPrepass},
+        layout{layout},
+        renderPass{[&] {
+          std::optional<vk::RenderPass> renderPass;
+          if (!dynamicRendering) {
+            renderPass.emplace(device, format, finalLayout, samples, depthFormat);
+          }
+          return renderPass;
+        }()} {
+    compile(library, vertexShader, fragmentShader);
+  }
+
+  PipelineInfo(PipelineInfo&&) = default;
+  PipelineInfo& operator=(PipelineInfo&&) = default;
+
+  ~PipelineInfo() {
+    // the compiles refer to the render pass
+    waitForCompiles();
+  }
+
+  // Checks whether the pipelines have finished compiling, rethrowing a failed compile. Returns true if they just have,
+  // so that anything recorded without drawing can be recorded again.
+  bool poll() {
+    if (ready_ || !compiled(pipeline) || !compiled(prepass)) {
+      return false;
+    }
+    pipeline->get();
+    if (prepass) {
+      prepass->get();
+    }
+    return ready_ = true;
+  }
+
+  // Swaps in pipelines built from new shaders, keeping the render pass and so every framebuffer made for it. Only
+  // pipelines whose desc has changed are compiled again; the prepass has no fragment shader, so a new one leaves it
+  // alone. The old pipelines are returned for the caller to retire, and render() draws nothing until poll() says the
+  // new ones are ready.
+  std::vector<vk::PipelineLibrary::Handle> recompile(
+      vk::PipelineLibrary& library,
+      Shader const& vertexShader,
+      Shader const& fragmentShader) {
+    wait();
+    std::vector<vk::PipelineLibrary::Handle> old{std::move(pipeline)};
+    if (prepass) {
+      old.push_back(std::move(prepass));
+    }
+    compile(library, vertexShader, fragmentShader);
+    ready_ = false;
+    return old;
+  }
+
+  // Blocks until every compile has finished, then poll()s.
+  void wait() {
+    waitForCompiles();
+    poll();
+  }
+
+  bool ready() const {
+    return ready_;
+  }
+
+  // Once retired, it is only destroyed after its compiles are done, so the deleter never blocks on them.
+  bool releasable() const {
+    return compiled(pipeline) && compiled(prepass);
+  }
+
+  // null with dynamic rendering, which is also what secondary buffers want to be given then
+  VkRenderPass renderPassHandle() const {
+    return renderPass ? static_cast<VkRenderPass>(*renderPass) : VkRenderPass{};
+  }
+
+  bool multisampled() const {
+    return samples != VK_SAMPLE_COUNT_1_BIT;
+  }
+
+  VkFormat format;
+  VkImageLayout finalLayout;
+  VkSampleCountFlagBits samples;
+  VkFormat depthFormat;
+  bool depthPrepass;
+  VkPipelineLayout layout;
+  std::optional<vk::RenderPass> renderPass;  // empty with dynamic rendering
+  vk::PipelineLibrary::Handle pipeline;
+  vk::PipelineLibrary::Handle prepass;  // null without a depth prepass
+
+ private:
+  static bool compiled(vk::PipelineLibrary::Handle const& handle) {
+    return !handle || handle->wait_for(std::chrono::seconds{0}) == std::future_status::ready;
+  }
+
+  void compile(vk::PipelineLibrary& library, Shader const& vertexShader, Shader const& fragmentShader) {
+    vk::PipelineDesc desc{
+        .vertex = {.module = vertexShader},
+        .fragment = vk::ShaderStage{.module = fragmentShader},
+        .layout = layout,
+        .target = renderTarget(),
+        .vertexInput = meshVertexInput(),
+        .depthTest = depthPrepass ? vk::DepthTest{.write = false, .compareOp = VK_COMPARE_OP_EQUAL} : vk::DepthTest{},
+    };
+    pipeline = library.get(desc);
+    if (depthPrepass) {
+      // the same vertex stage and inputs as `pipeline`, so the depth it lays down compares EQUAL there
+      desc.fragment.reset();
+      desc.depthTest = {};
+      prepass = library.get(desc);
+    }
+  }
+
+  void waitForCompiles() const {
+    for (auto const* handle : {&pipeline, &prepass}) {
+      if (*handle) {
+        (*handle)->wait();
+      }
+    }
+  }
+
+  vk::RenderTarget renderTarget() const {
+    return renderPass ? vk::RenderTarget::subpass(*renderPass, samples, depthFormat)
+                      : vk::RenderTarget::dynamic(format, samples, depthFormat);
+  }
+
+  bool ready_{};
+};
+
+// An attachment (a multisampled colour image, or depth) that only ever lives in tile memory: it is cleared, used and
+// discarded within the render pass, so on tile-based GPUs lazily allocated memory never actually gets backed. GPUs
+// without such memory get an ordinary device-local allocation. One is shared by all frames in flight, which render()
+// orders against each other.
+struct TransientAttachment {
+  TransientAttachment(
+      VkDevice device,
+      vk::Allocator& allocator,
+      VkFormat format,
+      VkExtent2D extent,
+      VkSampleCountFlagBits samples,
+      VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT)
+      : image{device,
+              format,
+              extent,
+              aspect == VK_IMAGE_ASPECT_COLOR_BIT
+                  ? VkImageUsageFlags{VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT}
+                  : VkImageUsageFlags{
+                        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT},
+              samples},
+        memory{[&] {
+          VkMemoryPropertyFlags properties{
+              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT};
+          if (!allocator.supports(image.memoryRequirements(), properties)) {
+            properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+          }
+          return allocator.allocateAndBind(image, properties);
+        }()},
+        imageView{device, image, format, aspect} {}
+
+  vk::Image image;
+  vk::Allocation memory;
+  vk::ImageView imageView;
+};
+
+// Framebuffers for `pipelineInfo`'s render pass, one per view: {view, depth}, or {multisampled view, view, depth} when
+// resolving.
+std::vector<vk::Framebuffer> createFramebuffers(
+    VkDevice device,
+    PipelineInfo const& pipelineInfo,
+    std::span<vk::ImageView const> imageViews,
+    TransientAttachment const* msaa,
+    TransientAttachment const& depth,
+    VkExtent2D extent) {
+  std::vector<vk::Framebuffer> framebuffers;
+  if (pipelineInfo.renderPass) {
+    for (auto const& iv : imageViews) {
+      std::vector<VkImageView> attachments;
+      if (msaa) {
+        attachments.push_back(msaa->imageView);
+      }
+      attachments.push_back(iv);
+      attachments.push_back(depth.imageView);
+      framebuffers.emplace_back(device, attachments, *pipelineInfo.renderPass, extent);
+    }
+  }
+  return framebuffers;
+}
+
+// Where one frame is rendered to.
+struct FrameTarget {
+  VkImage image;
+  VkImageView imageView;
+  VkImage msaaImage;          // null unless multisampled; drawn into and resolved into `image`
+  VkImageView msaaImageView;  // ditto
+  VkImage depthImage;
+  VkImageView depthImageView;
+  VkFramebuffer framebuffer;  // null with dynamic rendering
+  VkExtent2D extent;
+  // the graphics and present families when the image is presented from another family's queue, and so has to be
+  // released to it at the end of the frame; ignored otherwise
+  uint32_t releaseFrom{VK_QUEUE_FAMILY_IGNORED};
+  uint32_t releaseTo{VK_QUEUE_FAMILY_IGNORED};
+};
+
+// The present queue's half of handing swapchain images over from the graphics queue's family, for devices that can't
+// present from it: per image, a command buffer recorded once that acquires what the frame released, submitted between
+// renderFinished and the present. Images come back to the graphics queue as UNDEFINED, which discards their contents,
+// so nothing needs to be handed back.
+struct PresentHandoff {
+  // The acquire has to repeat the release's layouts exactly: `oldLayout` is the one render() releases the image from
+  // (still COLOR_ATTACHMENT_OPTIMAL with dynamic rendering, already `finalLayout` after a render pass).
+  PresentHandoff(
+      vk::Device const& device, std::span<VkImage const> images, VkImageLayout oldLayout, VkImageLayout finalLayout)
+      : from{device.graphicsQueue().familyIndex},
+        to{device.presentQueue().familyIndex},
+        pool{device, to},
+        commandBuffers{pool.allocateBuffers(static_cast<uint32_t>(images.size()))} {
+    for (size_t i{}; i < images.size(); i++) {
+      acquired.emplace_back(device);
+      done.emplace_back(device, VK_FENCE_CREATE_SIGNALED_BIT);
+
+      VkCommandBufferBeginInfo beginInfo{
+          .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      };
+      if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error{"failed to begin recording command buffer"};
+      }
+      // the present family needn't support graphics, so no stage narrower than ALL_COMMANDS is safe to name here
+      vk::cmdImageBarrier(
+          commandBuffers[i],
+          images[i],
+          oldLayout,
+          finalLayout,
+          VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+          0,
+          VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+          0,
+          VK_IMAGE_ASPECT_COLOR_BIT,
+          from,
+          to);
+      if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
+        throw std::runtime_error{"failed to record command buffer"};
+      }
+    }
+  }
+
+  // Acquires image `imgIdx` on the present queue once `renderFinished` is signaled, returning the semaphore to present
+  // on instead.
+  VkSemaphore submit(vk::Device const& device, uint32_t imgIdx, VkSemaphore renderFinished) const {
+    auto const& fence = done[imgIdx];
+    fence.wait();
+    fence.reset();
+
+    VkPipelineStageFlags const waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkSemaphore const signal = acquired[imgIdx];
+    VkSubmitInfo submitInfo{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .waitSemaphoreCount = 1,
+        .pWaitSemaphores = &renderFinished,
+        .pWaitDstStageMask = &waitStage,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &commandBuffers[imgIdx],
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &signal,
+    };
+    if (vkQueueSubmit(device.presentQueue().queue, 1, &submitInfo, fence) != VK_SUCCESS) {
+      throw std::runtime_error{"failed to submit ownership transfer"};
+    }
+    return signal;
+  }
+
+  bool releasable() const {
+    return std::ranges::all_of(done, [](auto const& fence) { return fence.signaled(); });
+  }
+
+  uint32_t from;
+  uint32_t to;
+  vk::CommandPool pool;
+  std::vector<VkCommandBuffer> commandBuffers;
+  std::vector<vk::Semaphore> acquired;
+  std::vector<vk::Fence> done;
+};
+
+// Everything that depends on the swapchain's images and extent, rebuilt on every resize.
 struct RenderInfo {
   RenderInfo(
-      GLFWwindow* window,
-      vk::Device const& device,
-      VkSurfaceKHR surface,
-      vk::ShaderModule const& vertexShader,
-      vk::ShaderModule const& fragmentShader,
-      VkPipelineLayout layout,
-      VkSwapchainKHR oldSwapchain = {})
-      : swapchain{window, device, surface, oldSwapchain},
+      vk::Device const& device, vk::Allocator& allocator, vk::Swapchain&& swapchainIn, PipelineInfo const& pipelineInfo)
+      : swapchain{std::move(swapchainIn)},
         imageViews{
             swapchain.images() |
             transform([&](auto const& img) { return vk::ImageView{device, img, swapchain.format()}; }) |
             to<std::vector>()},
-        renderPass{device, swapchain.format()},
-        pipeline{device, vertexShader, fragmentShader, layout, renderPass},
-        framebuffers{
-            imageViews | transform([&](auto const& iv) {
-              return vk::Framebuffer{device, std::array{static_cast<VkImageView>(iv)}, renderPass, swapchain.extent()};
-            }) |
-            to<std::vector>()} {}
+        msaa{[&] {
+          std::optional<TransientAttachment> msaa;
+          if (pipelineInfo.multisampled()) {
+            msaa.emplace(device, allocator, swapchain.format(), swapchain.extent(), pipelineInfo.samples);
+          }
+          return msaa;
+        }()},
+        depth{
+            device,
+            allocator,
+            pipelineInfo.depthFormat,
+            swapchain.extent(),
+            pipelineInfo.samples,
+            VK_IMAGE_ASPECT_DEPTH_BIT},
+        framebuffers{createFramebuffers(
+            device, pipelineInfo, imageViews, msaa ? &*msaa : nullptr, depth, swapchain.extent())},
+        renderFinished{
+            swapchain.images() | transform([&](auto const&) { return vk::Semaphore{device}; }) | to<std::vector>()},
+        presentFences{[&] {
+          std::vector<vk::Fence> fences;
+          if (device.hasExtension(VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME)) {
+            for (size_t i{}; i < swapchain.images().size(); i++) {
+              fences.emplace_back(device, VK_FENCE_CREATE_SIGNALED_BIT);
+            }
+          }
+          return fences;
+        }()},
+        handoff{[&] {
+          std::optional<PresentHandoff> handoff;
+          if (device.graphicsQueue().familyIndex != device.presentQueue().familyIndex) {
+            handoff.emplace(
+                device,
+                swapchain.images(),
+                pipelineInfo.renderPass ? pipelineInfo.finalLayout : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                pipelineInfo.finalLayout);
+          }
+          return handoff;
+        }()} {}
+
+  // without swapchain_maintenance1 there are no present fences and the frame the swapchain was retired on is all we
+  // have to go on.
+  bool releasable() const {
+    return std::ranges::all_of(presentFences, [](auto const& fence) { return fence.signaled(); }) &&
+           (!handoff || handoff->releasable());
+  }
+
+  // What the present has to wait on: renderFinished, or the ownership transfer queued after it.
+  VkSemaphore presentWait(vk::Device const& device, uint32_t imgIdx) const {
+    return handoff ? handoff->submit(device, imgIdx, renderFinished[imgIdx]) : VkSemaphore{renderFinished[imgIdx]};
+  }
+
+  VkFence presentFence(uint32_t imgIdx) const {
+    if (presentFences.empty()) {
+      return {};
+    }
+    auto const& fence = presentFences[imgIdx];
+    fence.wait();
+    fence.reset();
+    return fence;
+  }
+
+  FrameTarget target(uint32_t imgIdx) const {
+    return FrameTarget{
+        .image = swapchain.images()[imgIdx],
+        .imageView = imageViews[imgIdx],
+        .msaaImage = msaa ? VkImage{msaa->image} : VkImage{},
+        .msaaImageView = msaa ? VkImageView{msaa->imageView} : VkImageView{},
+        .depthImage = depth.image,
+        .depthImageView = depth.imageView,
+        .framebuffer = framebuffers.empty() ? VkFramebuffer{} : VkFramebuffer{framebuffers[imgIdx]},
+        .extent = swapchain.extent(),
+        .releaseFrom = handoff ? handoff->from : VK_QUEUE_FAMILY_IGNORED,
+        .releaseTo = handoff ? handoff->to : VK_QUEUE_FAMILY_IGNORED,
+    };
+  }
 
   vk::Swapchain swapchain;
   std::vector<vk::ImageView> imageViews;
-  vk::RenderPass renderPass;
-  vk::Pipeline pipeline;
-  std::vector<vk::Framebuffer> framebuffers;
+  std::optional<TransientAttachment> msaa;    // sized to the swapchain, so rebuilt with it
+  TransientAttachment depth;                  // ditto
+  std::vector<vk::Framebuffer> framebuffers;  // empty with dynamic rendering
+  // per image rather than per frame: the presentation engine holds on to it until the image comes back around, which
+  // has nothing to do with when the frame slot that rendered it is reused
+  std::vector<vk::Semaphore> renderFinished;
+  std::vector<vk::Fence> presentFences;  // one per image, empty unless VK_EXT_swapchain_maintenance1 is enabled
+  std::optional<PresentHandoff> handoff;  // only when presenting from a different queue family
+  uint64_t lastPresentId{};               // 0 until something has been presented with an id
 };
 
-void render(VkCommandBuffer commandBuffer, RenderInfo const& renderInfo, FrameIndex idx) {
-  vkResetCommandBuffer(commandBuffer, {});
+// Stand-in for the swapchain when running headless: one colour image per frame slot, so an image is never rendered to
+// while an earlier frame is still using it.
+struct OffscreenTargets {
+  OffscreenTargets(
+      VkDevice device, vk::Allocator& allocator, size_t count, VkExtent2D extent, PipelineInfo const& pipelineInfo)
+      : extent{extent},
+        depth{device, allocator, pipelineInfo.depthFormat, extent, pipelineInfo.samples, VK_IMAGE_ASPECT_DEPTH_BIT} {
+    for (size_t i{}; i < count; i++) {
+      auto const& image = images.emplace_back(device, pipelineInfo.format, extent, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT);
+      memory.push_back(allocator.allocateAndBind(image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+      imageViews.emplace_back(device, image, pipelineInfo.format);
+    }
+    if (pipelineInfo.multisampled()) {
+      msaa.emplace(device, allocator, pipelineInfo.format, extent, pipelineInfo.samples);
+    }
+    framebuffers = createFramebuffers(device, pipelineInfo, imageViews, msaa ? &*msaa : nullptr, depth, extent);
+  }
 
-  VkCommandBufferBeginInfo beginInfo{
-      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+  FrameTarget target(size_t idx) const {
+    return FrameTarget{
+        .image = images[idx],
+        .imageView = imageViews[idx],
+        .msaaImage = msaa ? VkImage{msaa->image} : VkImage{},
+        .msaaImageView = msaa ? VkImageView{msaa->imageView} : VkImageView{},
+        .depthImage = depth.image,
+        .depthImageView = depth.imageView,
+        .framebuffer = framebuffers.empty() ? VkFramebuffer{} : VkFramebuffer{framebuffers[idx]},
+        .extent = extent,
+    };
+  }
+
+  VkExtent2D extent;
+  std::vector<vk::Image> images;
+  std::vector<vk::Allocation> memory;
+  std::vector<vk::ImageView> imageViews;
+  std::optional<TransientAttachment> msaa;
+  TransientAttachment depth;
+  std::vector<vk::Framebuffer> framebuffers;  // empty with dynamic rendering
+};
+
+// Primary command buffers that are recorded once and then re-submitted every time the same frame slot renders to the
+// same image, until invalidate(). They are keyed by frame slot as well as image because the cull pass and the profiler
+// write to per-slot resources, and because waiting on the slot is what tells us a buffer is no longer pending. Anything
+// they reference must outlive them, so the whole set is retired and replaced whenever the targets or pipeline are.
+struct RecordedFrames {
+  struct Entry {
+    VkCommandBuffer commandBuffer;
+    bool recorded{};
+    std::vector<char const*> gpuScopes;  // handed back to the profiler on every re-submission
   };
-  if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
-    throw std::runtime_error{"failed to begin command buffer"};
+
+  RecordedFrames(VkDevice device, uint32_t queueFamilyIndex, size_t slotCount, size_t imageCount)
+      : imageCount{imageCount}, commandPool{device, queueFamilyIndex} {
+    for (auto commandBuffer : commandPool.allocateBuffers(static_cast<uint32_t>(slotCount * imageCount))) {
+      entries.push_back(Entry{.commandBuffer = commandBuffer});
+    }
   }
 
-  std::array clearValues{VkClearValue{{0, 0, 0, 1}}};
-  VkRenderPassBeginInfo renderPassInfo{
-      .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-      .renderPass = renderInfo.renderPass,
-      .framebuffer = renderInfo.framebuffers[idx],
-      .renderArea =
-          {
-              .offset = {0, 0},
-              .extent = renderInfo.swapchain.extent(),
-          },
-      .clearValueCount = static_cast<uint32_t>(clearValues.size()),
-      .pClearValues = clearValues.data(),
+  Entry& at(FrameIndex frameIdx, uint32_t imgIdx) {
+    return entries[frameIdx * imageCount + imgIdx];
+  }
+
+  // Whether any of `frameIdx`'s buffers would be re-submitted as they are, and so still read what they were recorded
+  // against.
+  bool anyRecorded(FrameIndex frameIdx) const {
+    auto first = entries.cbegin() + static_cast<std::ptrdiff_t>(frameIdx * imageCount);
+    return std::any_of(
+        first, first + static_cast<std::ptrdiff_t>(imageCount), [](auto const& entry) { return entry.recorded; });
+  }
+
+  // Re-records every buffer the next time it is used, for when the scene they draw has changed.
+  void invalidate() {
+    for (auto& entry : entries) {
+      entry.recorded = false;
+    }
+  }
+
+  size_t imageCount;
+  vk::CommandPool commandPool;
+  std::vector<Entry> entries;
+};
+
+// Matches the uniform block in main.vert.
+struct DrawUniforms {
+  std::array<float, 4> tint;
+};
+
+constexpr DrawUniforms kUntinted{.tint = {1, 1, 1, 1}};
+
+// Per-draw uniforms for every frame slot. Each slot has a persistently mapped arena, reset when the slot is next
+// recorded unless a buffer kept for re-submission still reads from it, and a descriptor set written once at startup
+// that points a UNIFORM_BUFFER_DYNAMIC binding at it. Giving a draw its own data is then a memcpy and a dynamic offset
+// at bind time: no descriptor set allocation or update and no map/unmap. Not thread-safe, so render() pushes
+// everything the recording workers will need before starting them.
+struct UniformRing {
+  static constexpr std::array kBindings{VkDescriptorSetLayoutBinding{
+      .binding = 0,
+      .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+  }};
+  static constexpr VkDeviceSize kBytesPerSlot{64 << 10};
+
+  struct Slot {
+    vk::LinearArena arena;
+    VkDescriptorSet descriptorSet;
+  };
+
+  UniformRing(
+      vk::Device const& device,
+      vk::Allocator& allocator,
+      vk::DescriptorPool const& descriptorPool,
+      VkDescriptorSetLayout setLayout,
+      size_t slotCount)
+      : alignment{device.physicalDeviceInfo().properties.limits.minUniformBufferOffsetAlignment} {
+    for (size_t i{}; i < slotCount; i++) {
+      auto& slot = slots.emplace_back(Slot{
+          .arena = vk::LinearArena{allocator, kBytesPerSlot, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT},
+          .descriptorSet = descriptorPool.allocate(setLayout),
+      });
+      vk::writeBufferDescriptors(
+          device,
+          slot.descriptorSet,
+          VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+          std::array{slot.arena.buffer()},
+          0,
+          sizeof(DrawUniforms));
+    }
+  }
+
+  // Copies `uniforms` into `slot`'s arena and returns the dynamic offset to bind them at.
+  uint32_t push(FrameIndex slot, DrawUniforms const& uniforms) {
+    auto slice = slots[slot].arena.push(sizeof(uniforms), alignment);
+    std::memcpy(slice.mapped, &uniforms, sizeof(uniforms));
+    return static_cast<uint32_t>(slice.offset);
+  }
+
+  void reset(FrameIndex slot) {
+    slots[slot].arena.reset();
+  }
+
+  VkDeviceSize alignment;
+  std::vector<Slot> slots;
+};
+
+// Matches Material in main.frag, at std430 layout.
+struct Material {
+  std::array<float, 4> tint;
+  uint32_t texture;  // into BindlessTable's textures
+  std::array<uint32_t, 3> padding;
+};
+
+// Every texture and material the scene draws with, in a single descriptor set that is bound once per command buffer
+// as set 0: binding 0 is the materials buffer, binding 1 a partially bound array of sampled textures. The array is
+// update-after-bind, so a texture can be added while frames using the set are in flight without a new set or a
+// rebind. Instances name their material, and materials their texture, by index; nothing is bound per draw.
+struct BindlessTable {
+  // descriptor indexing guarantees at least 500000 update-after-bind samplers per stage
+  static constexpr uint32_t kMaxTextures{1024};
+  static constexpr std::array kBindings{
+      VkDescriptorSetLayoutBinding{
+          .binding = 0,
+          .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          .descriptorCount = 1,
+          .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+      },
+      VkDescriptorSetLayoutBinding{
+          .binding = 1,
+          .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+          .descriptorCount = kMaxTextures,
+          .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+      },
   };
-  vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+  static constexpr std::array<VkDescriptorBindingFlags, 2> kBindingFlags{
+      0,
+      VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT |
+          VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT,
+  };
+
+  explicit BindlessTable(vk::Device const& device)
+      : device{requireDescriptorIndexing(device)},
+        setLayout{device, kBindings, kBindingFlags, VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT},
+        pool{
+            device,
+            1,
+            std::array{
+                VkDescriptorPoolSize{.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = 1},
+                VkDescriptorPoolSize{
+                    .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                    .descriptorCount = kMaxTextures,
+                },
+            },
+            VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT},
+        sampler{device},
+        descriptorSet{pool.allocate(setLayout)} {}
+
+  // Returns the index shaders sample `view` by. The slot it fills may be in use by a pending frame, as long as no
+  // frame in flight actually samples it.
+  uint32_t addTexture(VkImageView view) {
+    if (textureCount == kMaxTextures) {
+      throw std::runtime_error{"bindless texture table is full"};
+    }
+    vk::writeImageDescriptor(device, descriptorSet, 1, textureCount, sampler, view);
+    return textureCount++;
+  }
 
-  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, renderInfo.pipeline);
+  // Only before the set is first bound, since the materials binding isn't update-after-bind.
+  void setMaterials(VkBuffer materials) {
+    vk::writeBufferDescriptors(device, descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, std::array{materials});
+  }
+
+  // Device selection prefers devices that have it, so this only fails where none does.
+  static vk::Device const& requireDescriptorIndexing(vk::Device const& device) {
+    if (!device.features().descriptorIndexing) {
+      throw std::runtime_error{"device lacks the descriptor indexing features bindless textures need"};
+    }
+    return device;
+  }
+
+  VkDevice device;  // first, so the check runs before any update-after-bind object is created
+  vk::DescriptorSetLayout setLayout;
+  vk::DescriptorPool pool;
+  vk::Sampler sampler;
+  VkDescriptorSet descriptorSet;
+  uint32_t textureCount{};
+};
+
+// A `size`x`size` RGBA8 checkerboard of `cells`x`cells` squares alternating between `a` and `b`.
+std::vector<std::byte> checkerboard(uint32_t size, uint32_t cells, std::array<uint8_t, 4> a, std::array<uint8_t, 4> b) {
+  std::vector<std::byte> texels;
+  texels.reserve(size_t{size} * size * 4);
+  auto const cellSize = size / cells;
+  for (uint32_t y{}; y < size; y++) {
+    for (uint32_t x{}; x < size; x++) {
+      auto const& colour = (x / cellSize + y / cellSize) % 2 ? b : a;
+      for (auto channel : colour) {
+        texels.push_back(std::byte{channel});
+      }
+    }
+  }
+  return texels;
+}
+
+// The scene's textures and the materials made from them, registered with a BindlessTable.
+struct SceneMaterials {
+  static constexpr uint32_t kTextureSize{64};
+
+  SceneMaterials(VkDevice device, vk::Allocator& allocator, vk::Uploader& uploader, BindlessTable& table) {
+    constexpr std::array<uint8_t, 4> white{255, 255, 255, 255};
+    constexpr std::array<uint8_t, 4> grey{96, 96, 96, 255};
+    std::array const boards{checkerboard(kTextureSize, 8, white, grey), checkerboard(kTextureSize, 2, white, grey)};
+    textures.reserve(boards.size());
+    std::vector<uint32_t> indices;
+    for (auto const& board : boards) {
+      auto const& texture =
+          textures.emplace_back(device, allocator, uploader, VkExtent2D{kTextureSize, kTextureSize}, board);
+      indices.push_back(table.addTexture(texture.view));
+    }
+    std::array const materials{
+        Material{.tint = {1, 1, 1, 1}, .texture = indices[0]},
+        Material{.tint = {1, 0.6f, 0.6f, 1}, .texture = indices[1]},
+        Material{.tint = {0.6f, 1, 0.6f, 1}, .texture = indices[0]},
+        Material{.tint = {0.6f, 0.6f, 1, 1}, .texture = indices[1]},
+    };
+    count = static_cast<uint32_t>(materials.size());
+    buffer.emplace(
+        device,
+        allocator,
+        uploader,
+        std::as_bytes(std::span{materials}),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_ACCESS_SHADER_READ_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    table.setMaterials(buffer->buffer);
+  }
+
+  std::vector<vk::UploadedTexture> textures;
+  std::optional<vk::UploadedBuffer> buffer;
+  uint32_t count{};
+};
+
+// What recordDraws binds besides the pipeline: the view, and the draw's uniforms in `uniformSet` at `uniformOffset`.
+// `bindlessSet` is bound separately, once per command buffer, by bindBindless().
+struct DrawBindings {
+  VkPipelineLayout layout;
+  View view;
+  VkDescriptorSet bindlessSet;
+  VkDescriptorSet uniformSet;
+  uint32_t uniformOffset;
+};
+
+void bindBindless(VkCommandBuffer commandBuffer, DrawBindings const& bindings) {
+  vkCmdBindDescriptorSets(
+      commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, bindings.layout, 0, 1, &bindings.bindlessSet, 0, nullptr);
+}
+
+// Draws batches [firstBatch, endBatch) of `slot`, binding all the state they need first since a secondary command
+// buffer inherits none from the primary; the exception is the bindless set, which the caller binds.
+void recordDraws(
+    VkCommandBuffer commandBuffer,
+    VkPipeline pipeline,
+    DrawBindings const& bindings,
+    Mesh const& mesh,
+    DrawList::Slot const& slot,
+    VkExtent2D extent,
+    bool multiDrawIndirect,
+    uint32_t firstBatch,
+    uint32_t endBatch) {
+  if (firstBatch == endBatch) {
+    return;
+  }
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+  vkCmdPushConstants(
+      commandBuffer, bindings.layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(bindings.view), &bindings.view);
+  vkCmdBindDescriptorSets(
+      commandBuffer,
+      VK_PIPELINE_BIND_POINT_GRAPHICS,
+      bindings.layout,
+      1,
+      1,
+      &bindings.uniformSet,
+      1,
+      &bindings.uniformOffset);
 
   std::array viewports{VkViewport{
       .x = 0,
       .y = 0,
-      .width = static_cast<float>(renderInfo.swapchain.extent().width),
-      .height = static_cast<float>(renderInfo.swapchain.extent().height),
+      .width = static_cast<float>(extent.width),
+      .height = static_cast<float>(extent.height),
       .minDepth = 0,
       .maxDepth = 1,
   }};
   vkCmdSetViewport(commandBuffer, 0, static_cast<uint32_t>(viewports.size()), viewports.data());
 
   std::array scissors{VkRect2D{
-      .extent = renderInfo.swapchain.extent(),
+      .extent = extent,
   }};
   vkCmdSetScissor(commandBuffer, 0, static_cast<uint32_t>(scissors.size()), scissors.data());
 
-  vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+  std::array vertexBuffers{static_cast<VkBuffer>(mesh.vertices.buffer), static_cast<VkBuffer>(slot.visible)};
+  std::array vertexOffsets{VkDeviceSize{0}, VkDeviceSize{0}};
+  vkCmdBindVertexBuffers(
+      commandBuffer, 0, static_cast<uint32_t>(vertexBuffers.size()), vertexBuffers.data(), vertexOffsets.data());
+  vkCmdBindIndexBuffer(commandBuffer, mesh.indices.buffer, 0, VK_INDEX_TYPE_UINT16);
 
-  vkCmdEndRenderPass(commandBuffer);
+  constexpr uint32_t stride{sizeof(VkDrawIndexedIndirectCommand)};
+  if (multiDrawIndirect) {
+    vkCmdDrawIndexedIndirect(commandBuffer, slot.commands, firstBatch * stride, endBatch - firstBatch, stride);
+  } else {
+    for (auto batch = firstBatch; batch < endBatch; batch++) {
+      vkCmdDrawIndexedIndirect(commandBuffer, slot.commands, batch * stride, 1, stride);
+    }
+  }
+}
+
+// With `recordingWorkers` the render pass is recorded by them, each drawing a contiguous share of the batches into its
+// own secondary buffer; otherwise it is recorded inline.
+void render(
+    VkCommandBuffer commandBuffer,
+    vk::Device const& device,
+    PipelineInfo const& pipelineInfo,
+    Mesh const& mesh,
+    CullPipeline const& cull,
+    DrawList const& drawList,
+    FrameTarget const& target,
+    vk::RecordingWorkers* recordingWorkers,
+    UniformRing& uniformRing,
+    BindlessTable const& bindless,
+    prof::GpuProfiler& gpuProfiler,
+    FrameIndex frameIdx) {
+  vkResetCommandBuffer(commandBuffer, {});
+
+  VkCommandBufferBeginInfo beginInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+  };
+  if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+    throw std::runtime_error{"failed to begin command buffer"};
+  }
+
+  gpuProfiler.begin(commandBuffer, frameIdx);
+  {
+    auto frameScope = gpuProfiler.scope(commandBuffer, "frame");
+    auto const& slot = drawList.slots[frameIdx];
+    auto const view = View::fit(target.extent);
+
+    {
+      auto cullScope = gpuProfiler.scope(commandBuffer, "cull");
+      recordCull(commandBuffer, cull, mesh, drawList, slot, view);
+    }
+
+    // pushed after whatever the slot's arena already holds; the caller decides when that can be reset
+    auto drawBindings = [&] {
+      return DrawBindings{
+          .layout = pipelineInfo.layout,
+          .view = view,
+          .bindlessSet = bindless.descriptorSet,
+          .uniformSet = uniformRing.slots[frameIdx].descriptorSet,
+          .uniformOffset = uniformRing.push(frameIdx, kUntinted),
+      };
+    };
+
+    auto const multiDrawIndirect = device.features().multiDrawIndirect;
+    VkClearValue const clearColor{{0, 0, 0, 1}};
+    VkClearValue const clearDepth{.depthStencil = {.depth = 1}};
+    VkRect2D renderArea{
+        .offset = {0, 0},
+        .extent = target.extent,
+    };
+    auto renderPassScope = gpuProfiler.scope(commandBuffer, "render pass");
+    if (pipelineInfo.renderPass) {
+      // indexed by attachment, so the resolve attachment gets a (never used) value too
+      std::vector clearValues{clearColor};
+      if (pipelineInfo.multisampled()) {
+        clearValues.push_back(clearColor);
+      }
+      clearValues.push_back(clearDepth);
+      VkRenderPassBeginInfo renderPassInfo{
+          .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+          .renderPass = *pipelineInfo.renderPass,
+          .framebuffer = target.framebuffer,
+          .renderArea = renderArea,
+          .clearValueCount = static_cast<uint32_t>(clearValues.size()),
+          .pClearValues = clearValues.data(),
+      };
+      vkCmdBeginRenderPass(
+          commandBuffer,
+          &renderPassInfo,
+          recordingWorkers ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+    } else {
+      // the same transition and dependency the render pass would have made from its initial layout and external
+      // subpass dependency
+      vk::cmdImageBarrier(
+          commandBuffer,
+          target.image,
+          VK_IMAGE_LAYOUT_UNDEFINED,
+          VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+          VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+          0,
+          VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+          VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+      std::array colorAttachments{VkRenderingAttachmentInfoKHR{
+          .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR,
+          .imageView = target.imageView,
+          .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+          .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+          .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+          .clearValue = clearColor,
+      }};
+      if (target.msaaImage) {
+        // shared with the other frames in flight, so wait for the previous one's writes as well
+        vk::cmdImageBarrier(
+            commandBuffer,
+            target.msaaImage,
+            VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+        colorAttachments[0].resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT_KHR;
+        colorAttachments[0].resolveImageView = std::exchange(colorAttachments[0].imageView, target.msaaImageView);
+        colorAttachments[0].resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        colorAttachments[0].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+      }
+      VkPipelineStageFlags const depthStages{
+          VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT};
+      vk::cmdImageBarrier(
+          commandBuffer,
+          target.depthImage,
+          VK_IMAGE_LAYOUT_UNDEFINED,
+          VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+          depthStages,
+          VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+          depthStages,
+          VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+          VK_IMAGE_ASPECT_DEPTH_BIT);
+      VkRenderingAttachmentInfoKHR depthAttachment{
+          .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR,
+          .imageView = target.depthImageView,
+          .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+          .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+          .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+          .clearValue = clearDepth,
+      };
+      VkRenderingInfoKHR renderingInfo{
+          .sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR,
+          .flags = recordingWorkers ? VkRenderingFlagsKHR{VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT_KHR}
+                                    : VkRenderingFlagsKHR{},
+          .renderArea = renderArea,
+          .layerCount = 1,
+          .colorAttachmentCount = static_cast<uint32_t>(colorAttachments.size()),
+          .pColorAttachments = colorAttachments.data(),
+          .pDepthAttachment = &depthAttachment,
+      };
+      device.dispatch().cmdBeginRendering(commandBuffer, &renderingInfo);
+    }
+
+    if (!pipelineInfo.ready()) {
+      // still compiling, so the frame is just the clear
+    } else if (recordingWorkers) {
+      VkCommandBufferInheritanceRenderingInfoKHR renderingInheritance{
+          .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO_KHR,
+          .colorAttachmentCount = 1,
+          .pColorAttachmentFormats = &pipelineInfo.format,
+          .depthAttachmentFormat = pipelineInfo.depthFormat,
+          .rasterizationSamples = pipelineInfo.samples,
+      };
+      auto perWorker = (drawList.batchCount + recordingWorkers->size() - 1) / recordingWorkers->size();
+      auto const prepassBindings = drawBindings();
+      std::vector<DrawBindings> workerBindings;
+      for (uint32_t i{}; i < recordingWorkers->size(); i++) {
+        workerBindings.push_back(drawBindings());
+      }
+      auto secondaries = recordingWorkers->record(
+          frameIdx,
+          VkCommandBufferInheritanceInfo{
+              .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+              .pNext = pipelineInfo.renderPass ? nullptr : &renderingInheritance,
+              .renderPass = pipelineInfo.renderPassHandle(),
+              .subpass = 0,
+              .framebuffer = target.framebuffer,
+          },
+          [&](VkCommandBuffer secondary, uint32_t worker) {
+            bindBindless(secondary, workerBindings[worker]);
+            // the first worker lays down all of the depth, since splitting the prepass too would let later workers'
+            // depth land after earlier workers had already shaded what it hides
+            if (worker == 0 && pipelineInfo.depthPrepass) {
+              recordDraws(
+                  secondary,
+                  pipelineInfo.prepass->get(),
+                  prepassBindings,
+                  mesh,
+                  slot,
+                  target.extent,
+                  multiDrawIndirect,
+                  0,
+                  drawList.batchCount);
+            }
+            auto first = std::min(worker * perWorker, drawList.batchCount);
+            auto end = std::min(first + perWorker, drawList.batchCount);
+            recordDraws(
+                secondary,
+                pipelineInfo.pipeline->get(),
+                workerBindings[worker],
+                mesh,
+                slot,
+                target.extent,
+                multiDrawIndirect,
+                first,
+                end);
+          });
+      vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+    } else {
+      auto const batchCount = drawList.batchCount;
+      auto const bindings = drawBindings();
+      bindBindless(commandBuffer, bindings);
+      if (auto const& prepass = pipelineInfo.prepass) {
+        auto const prepassBindings = drawBindings();
+        recordDraws(
+            commandBuffer,
+            prepass->get(),
+            prepassBindings,
+            mesh,
+            slot,
+            target.extent,
+            multiDrawIndirect,
+            0,
+            batchCount);
+      }
+      VkPipeline const pipeline = pipelineInfo.pipeline->get();
+      recordDraws(commandBuffer, pipeline, bindings, mesh, slot, target.extent, multiDrawIndirect, 0, batchCount);
+    }
+
+    // presentation is ordered by the renderFinished semaphore, so nothing on this queue needs to wait on the final
+    // transition or the release of the image to the present family
+    auto const releasing = target.releaseFrom != target.releaseTo;
+    if (pipelineInfo.renderPass) {
+      vkCmdEndRenderPass(commandBuffer);
+      if (releasing) {
+        // the pass has already moved the image to its final layout
+        vk::cmdImageBarrier(
+            commandBuffer,
+            target.image,
+            pipelineInfo.finalLayout,
+            pipelineInfo.finalLayout,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            0,
+            VK_IMAGE_ASPECT_COLOR_BIT,
+            target.releaseFrom,
+            target.releaseTo);
+      }
+    } else {
+      device.dispatch().cmdEndRendering(commandBuffer);
+      if (pipelineInfo.finalLayout != VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL || releasing) {
+        vk::cmdImageBarrier(
+            commandBuffer,
+            target.image,
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            pipelineInfo.finalLayout,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            0,
+            VK_IMAGE_ASPECT_COLOR_BIT,
+            target.releaseFrom,
+            target.releaseTo);
+      }
+    }
+  }
 
   if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
     throw std::runtime_error{"failed to record command buffer"};
   }
 }
 
-int main() {
-  glfw::GlobalState glfwState;
-  glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+// What a run actually used where the device or build may have overridden the options.
+struct RunSettings {
+  VkSampleCountFlagBits samples;
+  uint32_t draws;
+  FrameIndex framesInFlight;
+  bool dynamicRendering;
+};
+
+// Writes one run as a JSON object: the device, the scene and settings, and the throughput and timings of the frames
+// after the warm-up. vulkan-tinker-bench collects these into a sweep.
+void writeRunJson(
+    std::filesystem::path const& path,
+    cli::Options const& options,
+    RunSettings const& settings,
+    vk::Device const& device,
+    uint64_t frames,
+    double seconds,
+    prof::GpuProfiler& gpuProfiler,
+    prof::FrameTimer const& frameTimer) {
+  std::ofstream out{path};
+  out.exceptions(std::ios::failbit | std::ios::badbit);
+  auto const& props = device.physicalDeviceInfo().properties;
+  out << "{\"device\":{\"name\":";
+  prof::writeJsonString(out, props.deviceName);
+  out << ",\"vendor_id\":" << props.vendorID << ",\"device_id\":" << props.deviceID
+      << ",\"driver_version\":" << props.driverVersion << ",\"api_version\":\""
+      << VK_API_VERSION_MAJOR(props.apiVersion) << '.' << VK_API_VERSION_MINOR(props.apiVersion) << '.'
+      << VK_API_VERSION_PATCH(props.apiVersion) << "\"}";
+  out << std::boolalpha << ",\"config\":{\"headless\":" << options.headless << ",\"instances\":" << options.instances
+      << ",\"draws\":" << settings.draws << ",\"triangles\":" << options.triangles
+      << ",\"msaa\":" << static_cast<uint32_t>(settings.samples)
+      << ",\"frames_in_flight\":" << static_cast<uint32_t>(settings.framesInFlight)
+      << ",\"record_threads\":" << options.recordThreads << ",\"reuse_command_buffers\":" << options.reuseCommandBuffers
+      << ",\"dynamic_rendering\":" << settings.dynamicRendering << ",\"depth_prepass\":" << options.depthPrepass
+      << ",\"host_allocator\":" << options.hostAllocator << '}';
+  out << ",\"warmup_frames\":" << options.warmupFrames << ",\"frames\":" << frames << std::fixed
+      << std::setprecision(6) << ",\"seconds\":" << seconds
+      // JSON has no inf or nan, which a run closed before its warm-up ended would otherwise print
+      << ",\"fps\":" << (frames ? static_cast<double>(frames) / seconds : 0.0)
+      << ",\"ms_per_frame\":" << (frames ? seconds * 1e3 / static_cast<double>(frames) : 0.0);
+  out << ",\"gpu\":";
+  gpuProfiler.writeJson(out);
+  out << ",\"cpu\":";
+  frameTimer.writeJson(out);
+  out << "}\n";
+}
+
+int main(int argc, char** argv) {
+  auto options = cli::parse(argc, argv);
+  auto const framesInFlight = static_cast<FrameIndex>(options.framesInFlight.value_or(kDefaultFramesInFlight));
+  if (options.hostAllocator) {
+    vk::HostAllocator::get().install();
+  }
+
+  // headless runs never touch glfw, so they work on machines with no display at all
+  std::optional<glfw::GlobalState> glfwState;
+  std::optional<glfw::Window> window;
+  if (!options.headless) {
+    glfwState.emplace();
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    window.emplace(kWindowExtent.width, kWindowExtent.height, kName);
+  }
 
   {
-    glfw::Window window{1920, 1080, kName};
-    vk::Instance instance{kName, {}, {{"VK_LAYER_KHRONOS_validation"}}};
-    vk::Surface surface{instance, window};
-    vk::Device device{instance, surface, std::array{VK_KHR_SWAPCHAIN_EXTENSION_NAME}};
-    vk::PipelineLayout shaderLayout{device};
-    vk::ShaderModule vertexShader{device, "main.vert.spv"};
-    vk::ShaderModule fragmentShader{device, "main.frag.spv"};
+    auto instanceExtensions =
+        options.headless
+            ? vk::Functionality{}
+            : vk::Functionality{
+                  .required = glfw::getRequiredInstanceExtensions() | to<std::vector>(),
+                  .optional =
+                      {VK_KHR_GET_SURFACE_CAPABILITIES_2_EXTENSION_NAME, VK_EXT_SURFACE_MAINTENANCE_1_EXTENSION_NAME},
+              };
+    // validation is only ever asked for, never required, so a machine without the layer still runs
+    vk::Functionality layers;
+    std::optional<VkDebugUtilsMessengerCreateInfoEXT> instanceMessenger;
+    if (options.validation) {
+      layers.optional.push_back("VK_LAYER_KHRONOS_validation");
+      if (std::ranges::any_of(vk::enumerateInstanceExtensionProperties(), [](auto const& ext) {
+            return std::string_view{ext.extensionName} == VK_EXT_DEBUG_UTILS_EXTENSION_NAME;
+          })) {
+        instanceExtensions.required.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+        instanceMessenger = vk::DebugMessenger::createInfo(*options.validation);
+      }
+    }
+    vk::Instance instance{
+        kName,
+        std::move(instanceExtensions),
+        std::move(layers),
+        instanceMessenger ? &*instanceMessenger : nullptr};
+    std::optional<vk::DebugMessenger> debugMessenger;
+    if (instanceMessenger) {
+      debugMessenger.emplace(instance, *options.validation);
+    }
+    std::optional<vk::Surface> surface;
+    if (window) {
+      surface.emplace(instance, *window);
+    }
+    vk::Functionality deviceExtensions{.optional = {VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME}};
+    if (!options.headless) {
+      deviceExtensions.required.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+      deviceExtensions.optional.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+      deviceExtensions.optional.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+      if (instance.hasExtension(VK_EXT_SURFACE_MAINTENANCE_1_EXTENSION_NAME)) {
+        deviceExtensions.optional.push_back(VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME);
+      }
+    }
+    vk::Device device{
+        instance, surface ? *surface : VkSurfaceKHR{}, std::move(deviceExtensions), options.gpu.value_or("")};
+    std::cout << "using " << device.physicalDeviceInfo().properties.deviceName << '\n';
+    auto const dynamicRendering = options.dynamicRendering && device.features().dynamicRendering;
+    auto const samples = chooseSampleCount(device.physicalDeviceInfo().properties.limits, options.msaaSamples);
+    auto const depthFormat = chooseDepthFormat(device.physicalDevice());
+    vk::PipelineCache pipelineCache{device, "pipeline-cache"};
+    auto vertexShader = std::make_shared<vk::ShaderModule const>(loadShader(device, "main.vert.spv"));
+    auto fragmentShader = std::make_shared<vk::ShaderModule const>(loadShader(device, "main.frag.spv"));
+    vk::PipelineCompiler pipelineCompiler;
+    vk::PipelineLibrary pipelineLibrary{device, pipelineCache, pipelineCompiler};
+    std::optional<vk::ShaderWatcher> shaderWatcher;
+    if (options.watchShaders) {
+      shaderWatcher.emplace(
+          pipelineCompiler, *options.watchShaders, std::vector<std::string>{"main.vert", "main.frag", "cull.comp"});
+    }
     vk::CommandPool commandPool{device, device.graphicsQueue().familyIndex};
+    vk::Allocator allocator{device};
+    vk::Uploader uploader{device, allocator};
+    TriangleFan const fan{options.triangles};
+    Mesh mesh{device, allocator, uploader, fan.vertices, fan.indices};
+    CullPipeline cullPipeline{device, pipelineCache};
+    BindlessTable bindless{device};
+    SceneMaterials sceneMaterials{device, allocator, uploader, bindless};
+    vk::DescriptorSetLayout uniformSetLayout{device, UniformRing::kBindings};
+    vk::PipelineLayout shaderLayout{
+        device,
+        std::array{
+            static_cast<VkDescriptorSetLayout>(bindless.setLayout),
+            static_cast<VkDescriptorSetLayout>(uniformSetLayout),
+        },
+        std::array{VkPushConstantRange{
+            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+            .offset = 0,
+            .size = sizeof(View),
+        }}};
+    // one cull set and one uniform set per frame slot
+    vk::DescriptorPool descriptorPool{
+        device,
+        2u * framesInFlight,
+        std::array{
+            VkDescriptorPoolSize{
+                .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .descriptorCount = static_cast<uint32_t>(CullPipeline::kBindings.size()) * framesInFlight,
+            },
+            VkDescriptorPoolSize{
+                .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                .descriptorCount = static_cast<uint32_t>(UniformRing::kBindings.size()) * framesInFlight,
+            },
+        }};
+    DrawList drawList{
+        device,
+        allocator,
+        uploader,
+        descriptorPool,
+        cullPipeline,
+        mesh,
+        gridInstances(options.instances, sceneMaterials.count),
+        // every batch but the first starts at a non-zero firstInstance, so without that feature there is only one
+        !device.features().drawIndirectFirstInstance ? options.instances
+        : options.draws                              ? (options.instances + *options.draws - 1) / *options.draws
+                                                     : kInstancesPerBatch,
+        framesInFlight};
+    UniformRing uniformRing{device, allocator, descriptorPool, uniformSetLayout, framesInFlight};
+    device.setName<VkBuffer>(mesh.vertices.buffer, VK_OBJECT_TYPE_BUFFER, "mesh vertices");
+    device.setName<VkBuffer>(mesh.indices.buffer, VK_OBJECT_TYPE_BUFFER, "mesh indices");
+    device.setName<VkBuffer>(drawList.instances.buffer, VK_OBJECT_TYPE_BUFFER, "instances");
+    for (auto const& slot : drawList.slots) {
+      device.setName<VkBuffer>(slot.visible, VK_OBJECT_TYPE_BUFFER, "visible instances");
+      device.setName<VkBuffer>(slot.commands, VK_OBJECT_TYPE_BUFFER, "indirect commands");
+    }
+    device.setName<VkBuffer>(sceneMaterials.buffer->buffer, VK_OBJECT_TYPE_BUFFER, "materials");
+    for (auto const& texture : sceneMaterials.textures) {
+      device.setName<VkImage>(texture.image, VK_OBJECT_TYPE_IMAGE, "material texture");
+    }
+    device.setName(bindless.descriptorSet, VK_OBJECT_TYPE_DESCRIPTOR_SET, "bindless table");
+    uploader.submit();
+    std::optional<vk::RecordingWorkers> recordingWorkers;
+    if (options.recordThreads) {
+      recordingWorkers.emplace(device, device.graphicsQueue().familyIndex, options.recordThreads, framesInFlight);
+    }
+    prof::GpuProfiler gpuProfiler{device, framesInFlight};
+    prof::FrameTimer frameTimer;
+    using Phase = prof::FrameTimer::Phase;
+
+    // frames are numbered from 1 so that 0 can mean "nothing submitted yet". where timeline semaphores are available
+    // the gpu signals frameTimeline to each frame's number as it finishes, so its value is "frames completed".
+    uint64_t submittedFrame{};
+    uint64_t completedFrame{};
+    std::optional<vk::TimelineSemaphore> frameTimeline;
+    if (device.features().timelineSemaphore) {
+      frameTimeline.emplace(device);
+    }
+    raii::DeferredDeleter<RenderInfo> retiredRenderInfos;
+    raii::DeferredDeleter<PipelineInfo> retiredPipelineInfos;
+    raii::DeferredDeleter<RecordedFrames> retiredRecordedFrames;
+    raii::DeferredDeleter<vk::Pipeline> retiredPipelines;
+    raii::DeferredDeleter<vk::PipelineLibrary::Handle> retiredGraphicsPipelines;
 
-    std::optional<RenderInfo> renderInfo{
-        std::in_place, window, device, surface, vertexShader, fragmentShader, shaderLayout};
-    auto perFrame = commandPool.allocateBuffers(static_cast<uint32_t>(renderInfo->imageViews.size())) |
-                    transform([&](auto cb) { return SynchronizedCommandBuffer{device, cb}; }) | to<std::vector>();
+    std::optional<PipelineInfo> pipelineInfo;
+    std::optional<RenderInfo> renderInfo;
+    std::optional<OffscreenTargets> offscreenTargets;
+    std::optional<RecordedFrames> recordedFrames;
+    auto createRecordedFrames = [&](size_t imageCount) {
+      if (recordedFrames) {
+        retiredRecordedFrames.retire(std::move(*recordedFrames), submittedFrame);
+      }
+      recordedFrames.emplace(device, device.graphicsQueue().familyIndex, framesInFlight, imageCount);
+    };
+    auto createRenderInfo = [&] {
+      vk::Swapchain swapchain{
+          *window, device, *surface, renderInfo ? renderInfo->swapchain : VkSwapchainKHR{}, options.presentPolicy};
+      if (renderInfo) {
+        retiredRenderInfos.retire(std::move(*renderInfo), submittedFrame);
+      }
+      if (!pipelineInfo || pipelineInfo->format != swapchain.format()) {
+        if (pipelineInfo) {
+          retiredPipelineInfos.retire(std::move(*pipelineInfo), submittedFrame);
+        }
+        pipelineInfo.emplace(
+            device,
+            pipelineLibrary,
+            swapchain.format(),
+            vertexShader,
+            fragmentShader,
+            shaderLayout,
+            dynamicRendering,
+            samples,
+            depthFormat,
+            options.depthPrepass);
+      }
+      renderInfo.emplace(device, allocator, std::move(swapchain), *pipelineInfo);
+      if (options.reuseCommandBuffers) {
+        createRecordedFrames(renderInfo->swapchain.images().size());
+      }
+    };
+    if (options.headless) {
+      pipelineInfo.emplace(
+          device,
+          pipelineLibrary,
+          kOffscreenFormat,
+          vertexShader,
+          fragmentShader,
+          shaderLayout,
+          dynamicRendering,
+          samples,
+          depthFormat,
+          options.depthPrepass,
+          VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+      // a benchmark should time drawing, not the frames spent waiting on the compiler
+      pipelineInfo->wait();
+      offscreenTargets.emplace(device, allocator, framesInFlight, kWindowExtent, *pipelineInfo);
+      if (options.reuseCommandBuffers) {
+        createRecordedFrames(framesInFlight);
+      }
+    } else {
+      createRenderInfo();
+    }
+
+    auto perFrame = commandPool.allocateBuffers(framesInFlight) |
+                    transform([&](auto cb) {
+                      return SynchronizedCommandBuffer{device, cb, !frameTimeline};
+                    }) |
+                    to<std::vector>();
     FrameIndex frameIdx = 0;
-    while (!glfwWindowShouldClose(window)) {
-      glfwPollEvents();
+    // Returns the command buffer to submit for this frame, recording it unless a still-valid recording can be reused.
+    auto recordFrame = [&](VkCommandBuffer cmd, uint32_t imgIdx, FrameTarget const& target) {
+      auto record = [&](VkCommandBuffer commandBuffer, vk::RecordingWorkers* workers) {
+        // the slot's previous frame has completed, so its uniforms are free to overwrite, unless another image's buffer
+        // for the slot is kept for re-submission: that still reads the offsets it was recorded with, so the slot's
+        // recordings pile up in its arena until they are all invalidated
+        if (!recordedFrames || !recordedFrames->anyRecorded(frameIdx)) {
+          uniformRing.reset(frameIdx);
+        }
+        render(
+            commandBuffer,
+            device,
+            *pipelineInfo,
+            mesh,
+            cullPipeline,
+            drawList,
+            target,
+            workers,
+            uniformRing,
+            bindless,
+            gpuProfiler,
+            frameIdx);
+      };
+      if (!recordedFrames) {
+        record(cmd, recordingWorkers ? &*recordingWorkers : nullptr);
+        return cmd;
+      }
+      // a secondary is re-recorded (and its pool reset) every time its slot is, which would invalidate any primary
+      // kept around that executes it, so reused buffers are always recorded inline
+      auto& entry = recordedFrames->at(frameIdx, imgIdx);
+      if (entry.recorded) {
+        gpuProfiler.replay(frameIdx, entry.gpuScopes);
+      } else {
+        record(entry.commandBuffer, nullptr);
+        entry.gpuScopes = gpuProfiler.scopes(frameIdx);
+        entry.recorded = true;
+      }
+      return entry.commandBuffer;
+    };
+    auto startTime = std::chrono::steady_clock::now();
+    uint64_t presentId{};
+    bool warmingUp{options.warmupFrames > 0};
+    // a window can be closed early even when the frame count is fixed
+    while ((!window || !glfwWindowShouldClose(*window)) &&
+           (!options.frames || submittedFrame < options.warmupFrames + *options.frames)) {
+      // gpu timings of the warm-up frames are still to be collected at this point, and are dropped when they have been
+      if (warmingUp && submittedFrame == options.warmupFrames) {
+        warmingUp = false;
+        frameTimer.clear();
+        startTime = std::chrono::steady_clock::now();
+      }
+      frameTimer.beginFrame();
+      // in FIFO modes frames otherwise queue up behind vsync, each adding a refresh of latency. starting once the last
+      // one is on screen keeps the queue to the one frame being built, sampled as close to its vblank as we can tell.
+      if (renderInfo && renderInfo->lastPresentId && isFifo(renderInfo->swapchain.presentMode())) {
+        vk::waitForPresent(device, renderInfo->swapchain, renderInfo->lastPresentId, kPresentWaitTimeout);
+        frameTimer.mark(Phase::Pace);
+      }
+      if (window) {
+        glfwPollEvents();
+        frameTimer.mark(Phase::Poll);
+      }
+
+      auto& frame = perFrame[frameIdx];
+
+      if (frameTimeline) {
+        frameTimeline->wait(frame.submittedFrame);
+        completedFrame = frameTimeline->value();
+      } else {
+        frame.cmdBufferReady->wait();
+        // slots are waited on in submission order, so every frame up to this slot's last one is now complete
+        completedFrame = std::max(completedFrame, frame.submittedFrame);
+      }
+      retiredRenderInfos.collect(completedFrame);
+      retiredPipelineInfos.collect(completedFrame);
+      retiredRecordedFrames.collect(completedFrame);
+      retiredPipelines.collect(completedFrame);
+      retiredGraphicsPipelines.collect(completedFrame);
+      gpuProfiler.collect(frameIdx);
+      // frames complete in order, so the last warm-up frame's timings are the last of them to be collected
+      if (options.warmupFrames && frame.submittedFrame == options.warmupFrames) {
+        gpuProfiler.clear();
+      }
+      uploader.collect();
+      if (shaderWatcher) {
+        // only the pipelines built from a rebuilt shader are recompiled; everything else stays as it is
+        for (auto const& spirv : shaderWatcher->poll()) {
+          if (spirv.filename() == CullPipeline::kShader) {
+            retiredPipelines.retire(cullPipeline.reload(device, pipelineCache), submittedFrame);
+          } else {
+            auto& shader = spirv.filename() == "main.vert.spv" ? vertexShader : fragmentShader;
+            shader = std::make_shared<vk::ShaderModule const>(device, spirv);
+            for (auto& old : pipelineInfo->recompile(pipelineLibrary, vertexShader, fragmentShader)) {
+              retiredGraphicsPipelines.retire(std::move(old), submittedFrame);
+            }
+          }
+          if (recordedFrames) {
+            recordedFrames->invalidate();
+          }
+          std::cout << "reloaded " << spirv.filename().string() << '\n';
+        }
+      }
+      if (pipelineInfo->poll() && recordedFrames) {
+        // anything recorded while the pipelines were compiling draws nothing
+        recordedFrames->invalidate();
+      }
+      frameTimer.mark(Phase::FenceWait);
 
-      auto& [cmdBuffer, imageAvailable, renderFinished, cmdBufferReady] = perFrame[frameIdx];
+      if (offscreenTargets) {
+        if (frame.cmdBufferReady) {
+          frame.cmdBufferReady->reset();
+        }
 
-      cmdBufferReady.wait();
+        auto commandBuffer = recordFrame(frame.commandBuffer, frameIdx, offscreenTargets->target(frameIdx));
+        frameTimer.mark(Phase::Record);
 
-      try {
-        auto imgIdx = vk::acquireNextImageKHR(device, renderInfo->swapchain, imageAvailable);
-        cmdBufferReady.reset();
+        frame.submittedFrame = ++submittedFrame;
+        vk::queueSubmit(
+            device,
+            commandBuffer,
+            {},
+            {},
+            frame.cmdBufferReady ? *frame.cmdBufferReady : VkFence{},
+            frameTimeline ? *frameTimeline : VkSemaphore{},
+            frame.submittedFrame);
+        frameIdx = (frameIdx + 1) % framesInFlight;
+        frameTimer.mark(Phase::Submit);
+      } else {
+        try {
+          auto imgIdx = vk::acquireNextImageKHR<false>(device, renderInfo->swapchain, frame.imageAvailable);
+          frameTimer.mark(Phase::Acquire);
+          if (frame.cmdBufferReady) {
+            frame.cmdBufferReady->reset();
+          }
 
-        render(cmdBuffer, *renderInfo, frameIdx);
+          auto commandBuffer = recordFrame(frame.commandBuffer, imgIdx, renderInfo->target(imgIdx));
+          frameTimer.mark(Phase::Record);
 
-        vk::queueSubmit(device, cmdBuffer, imageAvailable, renderFinished, cmdBufferReady);
-        vk::presentQueue(device, renderInfo->swapchain, renderFinished, imgIdx);
+          auto const& renderFinished = renderInfo->renderFinished[imgIdx];
+          frame.submittedFrame = ++submittedFrame;
+          vk::queueSubmit(
+              device,
+              commandBuffer,
+              frame.imageAvailable,
+              renderFinished,
+              frame.cmdBufferReady ? *frame.cmdBufferReady : VkFence{},
+              frameTimeline ? *frameTimeline : VkSemaphore{},
+              frame.submittedFrame);
+          frameIdx = (frameIdx + 1) % framesInFlight;
+          frameTimer.mark(Phase::Submit);
 
-        if (++frameIdx >= renderInfo->imageViews.size()) {
-          frameIdx = 0;
+          auto const id = device.features().presentWait ? ++presentId : 0;
+          vk::presentQueue(
+              device,
+              renderInfo->swapchain,
+              renderInfo->presentWait(device, imgIdx),
+              imgIdx,
+              renderInfo->presentFence(imgIdx),
+              id);
+          renderInfo->lastPresentId = id;
+          frameTimer.mark(Phase::Present);
+        } catch (vk::OutOfDateError const&) {
+          // the old swapchain is handed to its replacement and everything built on it is retired until the frames (and,
+          // where supported, the presents) that used it have completed, so recreation never drains the gpu.
+          createRenderInfo();
         }
-      } catch (vk::OutOfDateError const&) {
-        // irritatingly, there is *absolutely* no way (in standard VK) to know when an image has completed
-        // presentation so the only way to safely clean up the associated resources (pipeline, semaphore, etc) is to
-        // wait until the gpu idles.
-        vkDeviceWaitIdle(device);
-        renderInfo.emplace(window, device, surface, vertexShader, fragmentShader, shaderLayout);
-        frameIdx = 0;
       }
+      frameTimer.endFrame();
     }
 
     vkDeviceWaitIdle(device);
+    auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    if (renderInfo) {
+      for (auto const& fence : renderInfo->presentFences) {
+        fence.wait();
+      }
+    }
+    pipelineCache.save();
+
+    auto const measuredFrames = submittedFrame - std::min(submittedFrame, options.warmupFrames);
+    // the same guard as in writeRunJson, for a window closed before its warm-up ended
+    auto const fps = measuredFrames ? static_cast<double>(measuredFrames) / elapsed : 0.0;
+    auto const msPerFrame = measuredFrames ? elapsed * 1e3 / static_cast<double>(measuredFrames) : 0.0;
+    std::cout << measuredFrames << " frames in " << std::fixed << std::setprecision(3) << elapsed << " s: "
+              << std::setprecision(1) << fps << " fps (" << std::setprecision(3) << msPerFrame << " ms/frame)\n";
+    for (FrameIndex i{}; i < framesInFlight; i++) {
+      gpuProfiler.collect(i);
+    }
+    gpuProfiler.report(std::cout);
+    if (options.gpuTimingsCsv) {
+      gpuProfiler.writeCsv(*options.gpuTimingsCsv);
+    }
+    frameTimer.report(std::cout);
+    allocator.report(std::cout);
+    if (options.hostAllocator) {
+      vk::HostAllocator::get().report(std::cout);
+    }
+    if (options.cpuTrace) {
+      frameTimer.writeChromeTrace(*options.cpuTrace);
+    }
+    if (options.json) {
+      writeRunJson(
+          *options.json,
+          options,
+          RunSettings{
+              .samples = samples,
+              .draws = drawList.batchCount,
+              .framesInFlight = framesInFlight,
+              .dynamicRendering = dynamicRendering,
+          },
+          device,
+          measuredFrames,
+          elapsed,
+          gpuProfiler,
+          frameTimer);
+    }
   }
 
   return 0;
-}
+}
\ No newline at end of file
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace vk {
+
+// A whole file mapped read-only into memory, for handing straight to the API without reading it into the heap first.
+// The mapping starts on a page boundary, so its contents are suitably aligned for anything, SPIR-V words included.
+struct MappedFile {
+  explicit MappedFile(std::filesystem::path const& path) {
+    auto fail = [&](char const* what) {
+      return std::runtime_error{std::string{what} + " " + path.string()};
+    };
+#ifdef _WIN32
+    auto file = CreateFileW(
+        path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+      throw fail("failed to open");
+    }
+    LARGE_INTEGER size{};
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+      CloseHandle(file);
+      throw fail("failed to map empty or unreadable");
+    }
+    auto mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);  // the mapping keeps the file open
+    if (!mapping) {
+      throw fail("failed to map");
+    }
+    data_ = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);  // and the view keeps the mapping
+    if (!data_) {
+      throw fail("failed to map");
+    }
+    size_ = static_cast<size_t>(size.QuadPart);
+#else
+    auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      throw fail("failed to open");
+    }
+    struct stat status {};
+    if (fstat(fd, &status) != 0 || status.st_size == 0) {
+      close(fd);
+      throw fail("failed to map empty or unreadable");
+    }
+    size_ = static_cast<size_t>(status.st_size);
+    data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // the mapping keeps the file open
+    if (data_ == MAP_FAILED) {
+      data_ = nullptr;
+      throw fail("failed to map");
+    }
+#endif
+  }
+
+  MappedFile(MappedFile&& other) noexcept
+      : data_{std::exchange(other.data_, nullptr)}, size_{std::exchange(other.size_, 0)} {}
+  MappedFile& operator=(MappedFile other) noexcept {
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+    return *this;
+  }
+
+  ~MappedFile() {
+    if (!data_) {
+      return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(data_);
+#else
+    munmap(data_, size_);
+#endif
+  }
+
+  std::span<std::byte const> bytes() const {
+    return {static_cast<std::byte const*>(data_), size_};
+  }
+
+ private:
+  void* data_{};
+  size_t size_{};
+};
+
+}  // namespace vk
\ No newline at end of file
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "vulkan.hpp"
+
+// Whether validation can be turned on at all. CMake enables it for Debug builds only, so that Release builds never
+// load the layers or install a debug messenger.
+#ifndef VULKAN_TINKER_VALIDATION
+#  ifdef NDEBUG
+#    define VULKAN_TINKER_VALIDATION 0
+#  else
+#    define VULKAN_TINKER_VALIDATION 1
+#  endif
+#endif
+
+namespace cli {
+
+constexpr bool kValidationBuild{VULKAN_TINKER_VALIDATION};
+
+struct Options {
+  std::optional<std::filesystem::path> gpuTimingsCsv;
+  std::optional<std::filesystem::path> cpuTrace;
+  // the run's configuration, throughput and timings, as written for vulkan-tinker-bench
+  std::optional<std::filesystem::path> json;
+  bool headless{};                 // render offscreen without a window, surface or swapchain
+  std::optional<uint64_t> frames;  // stop after this many frames; headless runs default to kDefaultHeadlessFrames
+  uint64_t warmupFrames{};         // rendered before `frames`, and left out of every timing
+  uint32_t instances{1};           // copies of the mesh, laid out in a grid and drawn indirectly
+  std::optional<uint32_t> draws;   // indirect draws to split the instances over; none means batches of 1024
+  uint32_t triangles{1};           // in the mesh, as a fan over the same area
+  // none means the build's VULKAN_TINKER_FRAMES_IN_FLIGHT
+  std::optional<uint32_t> framesInFlight;
+  uint32_t recordThreads{};        // threads recording the render pass into secondary buffers; 0 records it inline
+  bool reuseCommandBuffers{};      // record each frame slot/image pair once and re-submit it until invalidated
+  bool dynamicRendering{true};     // use VK_KHR_dynamic_rendering instead of a render pass where supported
+  std::optional<std::string> gpu;  // part of a device name or a device UUID; overrides the automatic choice
+  vk::PresentPolicy presentPolicy{vk::PresentPolicy::Mailbox};
+  uint32_t msaaSamples{1};  // upper bound; the device may support fewer
+  bool depthPrepass{};      // draw everything depth-only first, then shade only what passes an EQUAL test
+  // directory of GLSL sources to recompile and reload shaders from when they change
+  std::optional<std::filesystem::path> watchShaders;
+  bool hostAllocator{};  // give the driver host memory from vk::HostAllocator and report its use per object type
+  // least severe validation message to print; none means no validation layer or messenger at all
+  std::optional<VkDebugUtilsMessageSeverityFlagBitsEXT> validation{
+      kValidationBuild ? std::optional{VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT} : std::nullopt};
+};
+
+constexpr uint64_t kDefaultHeadlessFrames{1000};
+constexpr uint32_t kMaxTriangles{65534};  // a fan of them has two vertices more, with 16-bit indices
+
+template <typename T> T parseNumber(std::string_view arg, std::string_view text) {
+  T value{};
+  auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+  if (ec != std::errc{} || end != text.data() + text.size()) {
+    throw std::runtime_error{"invalid value for " + std::string{arg} + ": " + std::string{text}};
+  }
+  return value;
+}
+
+inline std::optional<VkDebugUtilsMessageSeverityFlagBitsEXT> parseValidation(
+    std::string_view arg, std::string_view text) {
+  if (text == "off") {
+    return std::nullopt;
+  } else if (text == "error") {
+    return VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+  } else if (text == "warning") {
+    return VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT;
+  } else if (text == "info") {
+    return VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT;
+  } else if (text == "verbose") {
+    return VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT;
+  }
+  throw std::runtime_error{"invalid value for " + std::string{arg} + ": " + std::string{text}};
+}
+
+inline Options parse(int argc, char** argv) {
+  Options options;
+  bool validationGiven{};
+  for (int i{1}; i < argc; i++) {
+    std::string_view arg{argv[i]};
+    auto value = [&] {
+      if (++i >= argc) {
+        throw std::runtime_error{"missing value for " + std::string{arg}};
+      }
+      return std::string_view{argv[i]};
+    };
+
+    if (arg == "--gpu-timings-csv") {
+      options.gpuTimingsCsv = value();
+    } else if (arg == "--cpu-trace") {
+      options.cpuTrace = value();
+    } else if (arg == "--headless") {
+      options.headless = true;
+    } else if (arg == "--json") {
+      options.json = value();
+    } else if (arg == "--frames") {
+      options.frames = parseNumber<uint64_t>(arg, value());
+    } else if (arg == "--warmup-frames") {
+      options.warmupFrames = parseNumber<uint64_t>(arg, value());
+    } else if (arg == "--instances") {
+      options.instances = parseNumber<uint32_t>(arg, value());
+      if (options.instances == 0) {
+        throw std::runtime_error{"--instances must be at least 1"};
+      }
+    } else if (arg == "--draws") {
+      options.draws = parseNumber<uint32_t>(arg, value());
+      if (options.draws == 0u) {
+        throw std::runtime_error{"--draws must be at least 1"};
+      }
+    } else if (arg == "--triangles") {
+      options.triangles = parseNumber<uint32_t>(arg, value());
+      if (options.triangles == 0 || options.triangles > kMaxTriangles) {
+        throw std::runtime_error{"--triangles must be from 1 to " + std::to_string(kMaxTriangles)};
+      }
+    } else if (arg == "--frames-in-flight") {
+      options.framesInFlight = parseNumber<uint32_t>(arg, value());
+      if (options.framesInFlight == 0u || options.framesInFlight > 16u) {
+        throw std::runtime_error{"--frames-in-flight must be from 1 to 16"};
+      }
+    } else if (arg == "--reuse-command-buffers") {
+      options.reuseCommandBuffers = true;
+    } else if (arg == "--present-mode") {
+      auto mode = value();
+      if (mode == "mailbox") {
+        options.presentPolicy = vk::PresentPolicy::Mailbox;
+      } else if (mode == "low-latency") {
+        options.presentPolicy = vk::PresentPolicy::LowLatency;
+      } else if (mode == "fifo") {
+        options.presentPolicy = vk::PresentPolicy::Fifo;
+      } else if (mode == "fifo-relaxed") {
+        options.presentPolicy = vk::PresentPolicy::FifoRelaxed;
+      } else {
+        throw std::runtime_error{"invalid value for --present-mode: " + std::string{mode}};
+      }
+    } else if (arg == "--msaa") {
+      options.msaaSamples = parseNumber<uint32_t>(arg, value());
+      if (!std::has_single_bit(options.msaaSamples) || options.msaaSamples > VK_SAMPLE_COUNT_64_BIT) {
+        throw std::runtime_error{"--msaa must be a power of two from 1 to 64"};
+      }
+    } else if (arg == "--depth-prepass") {
+      options.depthPrepass = true;
+    } else if (arg == "--validation") {
+      options.validation = parseValidation(arg, value());
+      validationGiven = true;
+      if (options.validation && !kValidationBuild) {
+        throw std::runtime_error{"--validation needs a Debug build"};
+      }
+    } else if (arg == "--host-allocator") {
+      options.hostAllocator = true;
+    } else if (arg == "--watch-shaders") {
+      options.watchShaders = value();
+    } else if (arg == "--gpu") {
+      options.gpu = value();
+    } else if (arg == "--no-dynamic-rendering") {
+      options.dynamicRendering = false;
+    } else if (arg == "--record-threads") {
+      options.recordThreads = parseNumber<uint32_t>(arg, value());
+    } else {
+      throw std::runtime_error{"unknown argument " + std::string{arg}};
+    }
+  }
+  if (auto gpu = std::getenv("VULKAN_TINKER_GPU"); gpu && !options.gpu) {
+    options.gpu = gpu;
+  }
+  // the environment variable is ignored rather than fatal in builds without validation, since it may be set globally
+  if (auto validation = std::getenv("VULKAN_TINKER_VALIDATION"); validation && !validationGiven && kValidationBuild) {
+    options.validation = parseValidation("VULKAN_TINKER_VALIDATION", validation);
+  }
+  if (options.headless && !options.frames) {
+    options.frames = kDefaultHeadlessFrames;
+  }
+  return options;
+}
+
+}  // namespace cli
\ No newline at end of file
@@ -0,0 +1,427 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <numeric>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "vulkan.hpp"
+
+namespace prof {
+
+struct Summary {
+  size_t count{};
+  double min{};
+  double avg{};
+  double p50{};
+  double p95{};
+  double p99{};
+  double max{};
+};
+
+// Sorts `samples` in place.
+inline Summary summarize(std::vector<double>& samples) {
+  if (samples.empty()) {
+    return {};
+  }
+  std::ranges::sort(samples);
+  auto percentile = [&](double p) {
+    return samples[std::min(samples.size() - 1, static_cast<size_t>(p * static_cast<double>(samples.size())))];
+  };
+  return Summary{
+      .count = samples.size(),
+      .min = samples.front(),
+      .avg = std::accumulate(samples.cbegin(), samples.cend(), 0.0) / static_cast<double>(samples.size()),
+      .p50 = percentile(0.50),
+      .p95 = percentile(0.95),
+      .p99 = percentile(0.99),
+      .max = samples.back(),
+  };
+}
+
+// Writes `text` as a quoted JSON string.
+inline void writeJsonString(std::ostream& out, std::string_view text) {
+  out << '"';
+  for (auto c : text) {
+    if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec
+          << std::setfill(' ');
+    } else {
+      out << c;
+    }
+  }
+  out << '"';
+}
+
+// GPU timestamp profiler. Each frame slot owns a range of timestamp queries; a slot's results are read back when the
+// slot comes around again (by which point the caller has already waited for that frame), so the CPU never stalls on
+// the GPU to get them. Regions are identified by name, which must outlive the profiler (string literals, in practice).
+struct GpuProfiler {
+  GpuProfiler(vk::Device const& device, uint32_t frameSlots, uint32_t maxScopesPerFrame = 32)
+      : maxScopes_{maxScopesPerFrame},
+        timestampMask_{[&] {
+          auto validBits =
+              device.physicalDeviceInfo().queueFamilies[device.graphicsQueue().familyIndex].timestampValidBits;
+          return validBits >= 64 ? ~uint64_t{} : (uint64_t{1} << validBits) - 1;
+        }()},
+        nsPerTick_{device.physicalDeviceInfo().properties.limits.timestampPeriod},
+        queries_{device, VK_QUERY_TYPE_TIMESTAMP, frameSlots * maxScopesPerFrame * 2},
+        slots_(frameSlots) {}
+
+  // a queue family with no valid timestamp bits can't be profiled; every call becomes a no-op
+  bool enabled() const {
+    return timestampMask_ != 0;
+  }
+
+  // Reads back whatever `slot` recorded last time around. The frame that used it must already be known to be complete.
+  void collect(uint32_t slot) {
+    auto& scopes = slots_[slot].scopes;
+    if (scopes.empty()) {
+      return;
+    }
+    results_.resize(scopes.size() * 2);
+    if (queries_.results(firstQuery(slot), results_)) {
+      for (size_t i{}; i < scopes.size(); i++) {
+        auto ticks = (results_[i * 2 + 1] - results_[i * 2]) & timestampMask_;
+        region(scopes[i]).push_back(static_cast<double>(ticks) * nsPerTick_ / 1e6);
+      }
+    }
+    scopes.clear();
+  }
+
+  // Starts a frame's worth of scopes in `slot`. Must be recorded outside of a render pass.
+  void begin(VkCommandBuffer cmdBuffer, uint32_t slot) {
+    current_ = slot;
+    slots_[slot].scopes.clear();
+    if (enabled()) {
+      vkCmdResetQueryPool(cmdBuffer, queries_, firstQuery(slot), maxScopes_ * 2);
+    }
+  }
+
+  // The scopes `slot` has recorded since its last begin(). A caller that re-submits a command buffer instead of
+  // re-recording it keeps these and hands them back to replay() before each submission.
+  std::vector<char const*> const& scopes(uint32_t slot) const {
+    return slots_[slot].scopes;
+  }
+
+  void replay(uint32_t slot, std::vector<char const*> const& scopes) {
+    slots_[slot].scopes = scopes;
+  }
+
+  struct Scope {
+    Scope(Scope const&) = delete;
+    Scope& operator=(Scope const&) = delete;
+
+    ~Scope() {
+      if (profiler_) {
+        vkCmdWriteTimestamp(cmdBuffer_, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, profiler_->queries_, query_ + 1);
+      }
+    }
+
+   private:
+    friend GpuProfiler;
+    Scope(GpuProfiler* profiler, VkCommandBuffer cmdBuffer, uint32_t query)
+        : profiler_{profiler}, cmdBuffer_{cmdBuffer}, query_{query} {
+      if (profiler_) {
+        vkCmdWriteTimestamp(cmdBuffer_, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, profiler_->queries_, query_);
+      }
+    }
+
+    GpuProfiler* profiler_;
+    VkCommandBuffer cmdBuffer_;
+    uint32_t query_;
+  };
+
+  // Brackets GPU work recorded into `cmdBuffer` for as long as the returned scope lives.
+  [[nodiscard]] Scope scope(VkCommandBuffer cmdBuffer, char const* name) {
+    auto& scopes = slots_[current_].scopes;
+    if (!enabled() || scopes.size() >= maxScopes_) {
+      return Scope{nullptr, cmdBuffer, 0};
+    }
+    scopes.push_back(name);
+    return Scope{this, cmdBuffer, firstQuery(current_) + static_cast<uint32_t>(scopes.size() - 1) * 2};
+  }
+
+  void report(std::ostream& out) {
+    out << "gpu region                        samples    min ms    avg ms    p99 ms\n";
+    for (auto& [name, samples] : regions_) {
+      auto s = summarize(samples);
+      out << std::left << std::setw(32) << name << std::right << std::setw(9) << s.count << std::fixed
+          << std::setprecision(3) << std::setw(10) << s.min << std::setw(10) << s.avg << std::setw(10) << s.p99 << '\n';
+    }
+  }
+
+  // Writes every region as a JSON object from name to its summary, in ms.
+  void writeJson(std::ostream& out) {
+    out << '{';
+    for (bool first{true}; auto& [name, samples] : regions_) {
+      auto s = summarize(samples);
+      out << (first ? "" : ",");
+      writeJsonString(out, name);
+      out << std::fixed << std::setprecision(6) << ":{\"samples\":" << s.count << ",\"min_ms\":" << s.min
+          << ",\"avg_ms\":" << s.avg << ",\"p50_ms\":" << s.p50 << ",\"p95_ms\":" << s.p95 << ",\"p99_ms\":" << s.p99
+          << ",\"max_ms\":" << s.max << '}';
+      first = false;
+    }
+    out << '}';
+  }
+
+  // Forgets every sample collected so far, e.g. those of warm-up frames. Frames still in flight are collected as usual.
+  void clear() {
+    regions_.clear();
+  }
+
+  void writeCsv(std::filesystem::path const& path) {
+    std::ofstream out{path};
+    out.exceptions(std::ios::failbit | std::ios::badbit);
+    out << "region,samples,min_ms,avg_ms,p99_ms\n";
+    for (auto& [name, samples] : regions_) {
+      auto s = summarize(samples);
+      out << name << ',' << s.count << ',' << s.min << ',' << s.avg << ',' << s.p99 << '\n';
+    }
+  }
+
+ private:
+  struct Slot {
+    std::vector<char const*> scopes;
+  };
+
+  uint32_t firstQuery(uint32_t slot) const {
+    return slot * maxScopes_ * 2;
+  }
+
+  std::vector<double>& region(std::string_view name) {
+    auto it = std::ranges::find(regions_, name, [](auto const& r) { return r.first; });
+    if (it == regions_.end()) {
+      return regions_.emplace_back(name, std::vector<double>{}).second;
+    }
+    return it->second;
+  }
+
+  uint32_t maxScopes_;
+  uint64_t timestampMask_;
+  double nsPerTick_;
+  vk::QueryPool queries_;
+  std::vector<Slot> slots_;
+  uint32_t current_{};
+  std::vector<uint64_t> results_;
+  std::vector<std::pair<std::string_view, std::vector<double>>> regions_;
+};
+
+// Log-linear histogram of nanosecond durations with 16 sub-buckets per power of two (~6% resolution), so recording is a
+// couple of bit operations and an increment with no allocation.
+struct Histogram {
+  static constexpr uint32_t kSubBuckets{16};
+  static constexpr uint32_t kSubBucketBits{std::countr_zero(kSubBuckets)};
+
+  void record(uint64_t ns) {
+    counts_[bucket(ns)]++;
+    total_++;
+    max_ = std::max(max_, ns);
+  }
+
+  uint64_t total() const {
+    return total_;
+  }
+
+  uint64_t max() const {
+    return max_;
+  }
+
+  // Upper bound of the bucket holding the p'th sample.
+  uint64_t percentile(double p) const {
+    auto target = static_cast<uint64_t>(p * static_cast<double>(total_));
+    uint64_t seen{};
+    for (size_t i{}; i < counts_.size(); i++) {
+      seen += counts_[i];
+      if (seen > target) {
+        return std::min(lowerBound(i + 1), max_);
+      }
+    }
+    return max_;
+  }
+
+  // Prints one line per power-of-two range that has samples in it.
+  void print(std::ostream& out) const {
+    for (size_t octave{}; octave * kSubBuckets < counts_.size(); octave++) {
+      auto first = counts_.cbegin() + octave * kSubBuckets;
+      auto count = std::accumulate(first, first + kSubBuckets, uint64_t{});
+      if (count == 0) {
+        continue;
+      }
+      auto lo = lowerBound(octave * kSubBuckets);
+      auto hi = lowerBound((octave + 1) * kSubBuckets);
+      out << "  [" << std::fixed << std::setprecision(3) << std::setw(9) << lo / 1e6 << ", " << std::setw(9)
+          << hi / 1e6 << ") ms " << std::setw(9) << count << ' '
+          << std::string(std::max<size_t>(1, static_cast<size_t>(60 * count / total_)), '#') << '\n';
+    }
+  }
+
+ private:
+  static size_t bucket(uint64_t ns) {
+    if (ns < kSubBuckets) {
+      return static_cast<size_t>(ns);
+    }
+    auto shift = static_cast<uint32_t>(std::bit_width(ns)) - 1 - kSubBucketBits;
+    return (shift + 1) * kSubBuckets + static_cast<size_t>((ns >> shift) - kSubBuckets);
+  }
+
+  static uint64_t lowerBound(size_t bucket) {
+    if (bucket < kSubBuckets) {
+      return bucket;
+    }
+    auto shift = bucket / kSubBuckets - 1;
+    return (bucket % kSubBuckets + kSubBuckets) << shift;
+  }
+
+  std::array<uint64_t, 64 * kSubBuckets> counts_{};
+  uint64_t total_{};
+  uint64_t max_{};
+};
+
+// CPU-side timing of the main loop's phases. The last kRingSize frames are kept verbatim (for the Chrome trace) and
+// every frame is folded into per-phase histograms; nothing allocates after construction.
+struct FrameTimer {
+  enum class Phase : uint8_t { Pace, Poll, FenceWait, Acquire, Record, Submit, Present, Count };
+  static constexpr size_t kPhaseCount{static_cast<size_t>(Phase::Count)};
+  static constexpr std::array<char const*, kPhaseCount> kPhaseNames{
+      "pace", "poll", "fence wait", "acquire", "record", "submit", "present"};
+  static constexpr size_t kRingSize{4096};
+
+  FrameTimer() : ring_{std::make_unique<std::array<Frame, kRingSize>>()}, epoch_{Clock::now()} {}
+
+  void beginFrame() {
+    auto& frame = current();
+    frame.marks[0] = now();
+    lastMark_ = 0;
+  }
+
+  // Ends `phase`, which also starts the next one. Phases that were skipped over (e.g. after a failed acquire) are
+  // recorded as taking no time.
+  void mark(Phase phase) {
+    auto& frame = current();
+    auto t = now();
+    auto idx = static_cast<size_t>(phase) + 1;
+    while (lastMark_ + 1 < idx) {
+      frame.marks[lastMark_ + 1] = frame.marks[lastMark_];
+      lastMark_++;
+    }
+    frame.marks[idx] = t;
+    lastMark_ = idx;
+  }
+
+  void endFrame() {
+    auto& frame = current();
+    auto t = now();
+    while (lastMark_ < kPhaseCount) {
+      frame.marks[lastMark_ + 1] = frame.marks[lastMark_];
+      lastMark_++;
+    }
+    for (size_t i{}; i < kPhaseCount; i++) {
+      phases_[i].record(frame.marks[i + 1] - frame.marks[i]);
+    }
+    total_.record(t - frame.marks[0]);
+    frame.end = t;
+    frames_++;
+  }
+
+  void report(std::ostream& out) const {
+    out << "cpu phase                        frames    p50 ms    p95 ms    p99 ms    max ms\n";
+    auto line = [&](char const* name, Histogram const& h) {
+      out << std::left << std::setw(32) << name << std::right << std::setw(7) << h.total() << std::fixed
+          << std::setprecision(3) << std::setw(10) << h.percentile(0.50) / 1e6 << std::setw(10)
+          << h.percentile(0.95) / 1e6 << std::setw(10) << h.percentile(0.99) / 1e6 << std::setw(10) << h.max() / 1e6
+          << '\n';
+    };
+    for (size_t i{}; i < kPhaseCount; i++) {
+      line(kPhaseNames[i], phases_[i]);
+    }
+    line("frame", total_);
+    out << "cpu frame time histogram:\n";
+    total_.print(out);
+  }
+
+  // Writes every phase, and the whole frame, as a JSON object from name to its percentiles, in ms.
+  void writeJson(std::ostream& out) const {
+    out << '{';
+    auto entry = [&](char const* name, Histogram const& h) {
+      writeJsonString(out, name);
+      out << std::fixed << std::setprecision(6) << ":{\"frames\":" << h.total() << ",\"p50_ms\":"
+          << h.percentile(0.50) / 1e6 << ",\"p95_ms\":" << h.percentile(0.95) / 1e6 << ",\"p99_ms\":"
+          << h.percentile(0.99) / 1e6 << ",\"max_ms\":" << h.max() / 1e6 << '}';
+    };
+    for (size_t i{}; i < kPhaseCount; i++) {
+      entry(kPhaseNames[i], phases_[i]);
+      out << ',';
+    }
+    entry("frame", total_);
+    out << '}';
+  }
+
+  // Forgets every frame timed so far, e.g. the warm-up ones. Must not be called mid-frame.
+  void clear() {
+    frames_ = 0;
+    phases_ = {};
+    total_ = {};
+  }
+
+  // Writes the retained frames as Chrome trace events (load in chrome://tracing or Perfetto).
+  void writeChromeTrace(std::filesystem::path const& path) const {
+    std::ofstream out{path};
+    out.exceptions(std::ios::failbit | std::ios::badbit);
+    out << "{\"traceEvents\":[";
+    bool first{true};
+    auto event = [&](char const* name, uint64_t begin, uint64_t end) {
+      out << (first ? "" : ",") << "\n{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":"
+          << std::fixed << std::setprecision(3) << begin / 1e3 << ",\"dur\":" << (end - begin) / 1e3 << '}';
+      first = false;
+    };
+    for (auto i = frames_ - std::min<uint64_t>(frames_, kRingSize); i < frames_; i++) {
+      auto const& frame = (*ring_)[i % kRingSize];
+      event("frame", frame.marks[0], frame.end);
+      for (size_t p{}; p < kPhaseCount; p++) {
+        if (frame.marks[p + 1] > frame.marks[p]) {
+          event(kPhaseNames[p], frame.marks[p], frame.marks[p + 1]);
+        }
+      }
+    }
+    out << "\n]}\n";
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Frame {
+    std::array<uint64_t, kPhaseCount + 1> marks;  // ns since epoch_; marks[i] is the start of phase i
+    uint64_t end;
+  };
+
+  Frame& current() {
+    return (*ring_)[frames_ % kRingSize];
+  }
+
+  uint64_t now() const {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - epoch_).count());
+  }
+
+  std::unique_ptr<std::array<Frame, kRingSize>> ring_;
+  Clock::time_point epoch_;
+  uint64_t frames_{};
+  size_t lastMark_{};
+  std::array<Histogram, kPhaseCount> phases_{};
+  Histogram total_;
+};
+
+}  // namespace prof
\ No newline at end of file
@@ -3,9 +3,13 @@
 #include <memory>
 #include <optional>
 #include <set>
+#include <stdexcept>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
+#include <vulkan/vulkan.h>
+
 namespace raii {
 
 template <typename CRTP, typename T, T kNil = T{}> struct UniqueHandle {
@@ -56,7 +60,12 @@ template <typename CRTP, typename T, T kNil = T{}> struct UniqueHandle {
   T t_{kNil};
 };
 
-template <typename T, auto Dtor, typename Parent, typename AllocationCallbacks = std::nullptr_t, T kNil = T{}>
+template <
+    typename T,
+    auto Dtor,
+    typename Parent,
+    typename AllocationCallbacks = VkAllocationCallbacks const*,
+    T kNil = T{}>
 struct ParentedUniqueHandle : UniqueHandle<ParentedUniqueHandle<T, Dtor, Parent, AllocationCallbacks, kNil>, T> {
   ParentedUniqueHandle(Parent p, T t, AllocationCallbacks ac) : ParentedUniqueHandle{std::tuple{p, t, ac}} {}
   ParentedUniqueHandle(std::tuple<Parent, T, AllocationCallbacks> tup)
@@ -79,11 +88,60 @@ struct ParentedUniqueHandle : UniqueHandle<ParentedUniqueHandle<T, Dtor, Parent,
   AllocationCallbacks callbacks_;
 };
 
-template <typename Elem, auto Func, typename... Args> std::vector<Elem> VecFetcher(Args&&... args) {
+// Keeps retired objects alive until the GPU work that may still reference them has completed. Objects are tagged with
+// the last frame that could have used them and released once `collect` is told that frame has finished; types that
+// need more than that (e.g. waiting on present fences) can expose a `bool releasable() const` to veto release.
+template <typename T> struct DeferredDeleter {
+  void retire(T&& t, uint64_t lastUsedFrame) {
+    retired_.emplace_back(lastUsedFrame, std::move(t));
+  }
+
+  void collect(uint64_t completedFrame) {
+    std::erase_if(retired_, [&](auto const& r) { return r.first <= completedFrame && releasable(r.second); });
+  }
+
+  bool empty() const {
+    return retired_.empty();
+  }
+
+ private:
+  static bool releasable(T const& t) {
+    if constexpr (requires { t.releasable(); }) {
+      return t.releasable();
+    } else {
+      return true;
+    }
+  }
+
+  std::vector<std::pair<uint64_t, T>> retired_;
+};
+
+// Count-then-fill into `into`, which is resized to fit and can be anything with vector's resize() and data(). Reusing
+// one container across calls keeps its storage, so repeat queries don't allocate once it is big enough. If the count
+// grows between the two calls the API reports VK_INCOMPLETE, and the query is simply run again.
+template <auto Func, typename Container, typename... Args> void VecFetcherInto(Container& into, Args&&... args) {
   uint32_t count{};
-  Func(args..., &count, nullptr);
-  std::vector<Elem> elems{count};
-  Func(args..., &count, elems.data());
+  if constexpr (std::is_void_v<decltype(Func(args..., &count, nullptr))>) {
+    Func(args..., &count, nullptr);
+    into.resize(count);
+    Func(args..., &count, into.data());
+  } else {
+    VkResult result{};
+    do {
+      Func(args..., &count, nullptr);
+      into.resize(count);
+      result = Func(args..., &count, into.data());
+    } while (result == VK_INCOMPLETE);
+    if (result != VK_SUCCESS) {
+      throw std::runtime_error{"failed to enumerate Vulkan objects"};
+    }
+  }
+  into.resize(count);
+}
+
+template <typename Elem, auto Func, typename... Args> std::vector<Elem> VecFetcher(Args&&... args) {
+  std::vector<Elem> elems;
+  VecFetcherInto<Func>(elems, std::forward<Args>(args)...);
   return elems;
 }
 
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+#include "vulkan.hpp"
+
+namespace vk {
+
+// A fixed set of threads that record secondary command buffers for the inside of a render pass. Every worker has its
+// own command pool per frame slot, since pools are externally synchronized and a slot's pool can only be reset once
+// the frame that last used it has completed; recording itself never takes a lock. record() runs one job on all workers
+// at once and blocks until they have finished, and the primary then executes their buffers in worker order.
+struct RecordingWorkers {
+  // Runs once per worker with its secondary buffer, already begun inside the render pass, and the worker's index.
+  using Job = std::function<void(VkCommandBuffer, uint32_t)>;
+
+  RecordingWorkers(VkDevice device, uint32_t queueFamilyIndex, uint32_t workerCount, uint32_t slotCount)
+      : workers_(workerCount) {
+    if (workerCount == 0) {
+      throw std::runtime_error{"need at least one recording worker"};
+    }
+    for (auto& worker : workers_) {
+      for (uint32_t slot{}; slot < slotCount; slot++) {
+        auto& pool = worker.pools.emplace_back(device, queueFamilyIndex);
+        worker.buffers.push_back(pool.allocateBuffers(1, VK_COMMAND_BUFFER_LEVEL_SECONDARY).front());
+      }
+    }
+    // only start the threads once workers_ is fully built, since they index into it
+    for (uint32_t i{}; i < workerCount; i++) {
+      workers_[i].thread = std::jthread{[this, i](std::stop_token stop) { run(stop, i); }};
+    }
+  }
+
+  RecordingWorkers(RecordingWorkers const&) = delete;
+  RecordingWorkers& operator=(RecordingWorkers const&) = delete;
+
+  uint32_t size() const {
+    return static_cast<uint32_t>(workers_.size());
+  }
+
+  // Records `job` into every worker's buffer for `slot` and returns the buffers, which stay valid until the slot is
+  // next recorded. The first exception thrown by any worker is rethrown here once they have all finished.
+  std::span<VkCommandBuffer const> record(uint32_t slot, VkCommandBufferInheritanceInfo const& inheritance, Job job) {
+    {
+      std::lock_guard lock{mutex_};
+      job_ = std::move(job);
+      slot_ = slot;
+      inheritance_ = inheritance;
+      pending_ = size();
+      error_ = nullptr;
+      generation_++;
+    }
+    start_.notify_all();
+
+    std::unique_lock lock{mutex_};
+    done_.wait(lock, [&] { return pending_ == 0; });
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+    recorded_.clear();
+    for (auto const& worker : workers_) {
+      recorded_.push_back(worker.buffers[slot]);
+    }
+    return recorded_;
+  }
+
+ private:
+  struct Worker {
+    std::vector<CommandPool> pools;        // one per frame slot
+    std::vector<VkCommandBuffer> buffers;  // one secondary from each of `pools`
+    std::jthread thread;                   // last, so it is joined before the pools go away
+  };
+
+  void run(std::stop_token stop, uint32_t index) {
+    auto& worker = workers_[index];
+    uint64_t seen{};
+    while (true) {
+      std::unique_lock lock{mutex_};
+      if (!start_.wait(lock, stop, [&] { return generation_ != seen; })) {
+        return;
+      }
+      seen = generation_;
+      auto const slot = slot_;
+      auto const inheritance = inheritance_;
+      lock.unlock();
+
+      std::exception_ptr error;
+      try {
+        auto cmd = worker.buffers[slot];
+        worker.pools[slot].reset();
+        VkCommandBufferBeginInfo beginInfo{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+            .pInheritanceInfo = &inheritance,
+        };
+        if (vkBeginCommandBuffer(cmd, &beginInfo) != VK_SUCCESS) {
+          throw std::runtime_error{"failed to begin secondary command buffer"};
+        }
+        // the main thread is blocked in record() until we are done, so job_ can't change underneath us
+        job_(cmd, index);
+        if (vkEndCommandBuffer(cmd) != VK_SUCCESS) {
+          throw std::runtime_error{"failed to record secondary command buffer"};
+        }
+      } catch (...) {
+        error = std::current_exception();
+      }
+
+      lock.lock();
+      if (error && !error_) {
+        error_ = error;
+      }
+      if (--pending_ == 0) {
+        done_.notify_one();
+      }
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable_any start_;
+  std::condition_variable done_;
+  uint64_t generation_{};  // bumped once per record() call
+  uint32_t pending_{};     // workers yet to finish the current job
+  Job job_;
+  uint32_t slot_{};
+  VkCommandBufferInheritanceInfo inheritance_{};
+  std::exception_ptr error_;
+  std::vector<VkCommandBuffer> recorded_;
+  std::vector<Worker> workers_;  // last, so the threads stop before anything they use is destroyed
+};
+
+}  // namespace vk
\ No newline at end of file
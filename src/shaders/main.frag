@@ -1,9 +1,26 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragUv;
+layout(location = 2) flat in uint fragMaterial;
+
+struct Material {
+    vec4 tint;
+    uint texture;
+};
+
+// The bindless table: every material, and every texture they refer to.
+layout(std430, set = 0, binding = 0) readonly buffer Materials {
+    Material materials[];
+};
+layout(set = 0, binding = 1) uniform sampler2D textures[];
 
 layout(location = 0) out vec4 outColor;
 
 void main() {
-    outColor = vec4(fragColor, 1.0);
+    Material material = materials[fragMaterial];
+    // instances with different materials share a draw, so the index can differ within a subgroup
+    vec4 texel = texture(textures[nonuniformEXT(material.texture)], fragUv);
+    outColor = vec4(fragColor * material.tint.rgb * texel.rgb, 1.0);
 }
\ No newline at end of file
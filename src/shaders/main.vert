@@ -1,20 +1,29 @@
 #version 450
 
-layout(location = 0) out vec3 fragColor;
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec2 instanceOffset;
+layout(location = 3) in float instanceScale;
+layout(location = 4) in uint instanceMaterial;
+
+// Set once per pass: maps the scene into clip space.
+layout(push_constant) uniform View {
+    vec2 scale;
+    vec2 offset;
+} view;
 
-vec2 positions[3] = vec2[](
-    vec2(0.0, -0.5),
-    vec2(0.5, 0.5),
-    vec2(-0.5, 0.5)
-);
+// Per draw, at the dynamic offset the draw was bound with.
+layout(set = 1, binding = 0) uniform Draw {
+    vec4 tint;
+} draw;
 
-vec3 colors[3] = vec3[](
-    vec3(1.0, 0.0, 0.0),
-    vec3(0.0, 1.0, 0.0),
-    vec3(0.0, 0.0, 1.0)
-);
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragUv;
+layout(location = 2) flat out uint fragMaterial;
 
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-    fragColor = colors[gl_VertexIndex];
+    gl_Position = vec4((inPosition * instanceScale + instanceOffset) * view.scale + view.offset, 0.0, 1.0);
+    fragColor = inColor * draw.tint.rgb;
+    fragUv = inPosition + 0.5;
+    fragMaterial = instanceMaterial;
 }
\ No newline at end of file
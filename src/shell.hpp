@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdlib>
+#include <string>
+#include <string_view>
+
+namespace shell {
+
+// Quotes `arg` as one word for the shell std::system runs commands in.
+inline std::string quote(std::string_view arg) {
+#ifdef _WIN32
+  // cmd.exe doesn't allow quotes in file names, so there is nothing inside to escape
+  return '"' + std::string{arg} + '"';
+#else
+  std::string quoted{'\''};
+  for (auto c : arg) {
+    quoted += c == '\'' ? std::string{"'\\''"} : std::string{c};
+  }
+  return quoted + '\'';
+#endif
+}
+
+// Runs a command line built with quote() and returns its exit status.
+inline int run(std::string command) {
+#ifdef _WIN32
+  // cmd /c strips the first and last quote of a line that starts with one, so the whole line needs another pair
+  command = '"' + command + '"';
+#endif
+  return std::system(command.c_str());
+}
+
+}  // namespace shell
\ No newline at end of file
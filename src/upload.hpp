@@ -0,0 +1,343 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "allocator.hpp"
+#include "vulkan.hpp"
+
+namespace vk {
+
+// Copies data into device-local buffers and images through host-visible staging memory, from the device's transfer
+// queue. Where that is a separate family from graphics the copies run concurrently with rendering: the resources are
+// released by the transfer queue and acquired by the graphics queue, whose acquire submission waits on the copies and
+// is ordered before every later graphics submission. One batch is in flight at a time; staging memory is freed once
+// it lands.
+struct Uploader {
+  Uploader(Device const& device, Allocator& allocator)
+      : device_{device},
+        allocator_{allocator},
+        transferPool_{device, device.transferQueue().familyIndex},
+        transferCmd_{transferPool_.allocateBuffers(1).front()},
+        copied_{device},
+        done_{device, VK_FENCE_CREATE_SIGNALED_BIT} {
+    if (needsOwnershipTransfer()) {
+      acquirePool_.emplace(device, device.graphicsQueue().familyIndex);
+      acquireCmd_ = acquirePool_->allocateBuffers(1).front();
+    }
+  }
+
+  ~Uploader() {
+    done_.wait();
+  }
+
+  // Stages `data` for copying into `dst` at `dstOffset`. `dstAccess`/`dstStage` describe how the graphics queue will
+  // first use the buffer. Nothing is sent to the GPU until submit().
+  void upload(
+      Buffer const& dst,
+      std::span<std::byte const> data,
+      VkAccessFlags dstAccess,
+      VkPipelineStageFlags dstStage,
+      VkDeviceSize dstOffset = 0) {
+    Buffer staging{device_, data.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT};
+    auto memory = allocator_.allocateAndBind(
+        staging, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    std::memcpy(memory.mapped(), data.data(), data.size());
+    pending_.push_back(Copy{
+        .dst = dst,
+        .image = VK_NULL_HANDLE,
+        .extent = {},
+        .dstOffset = dstOffset,
+        .size = data.size(),
+        .dstAccess = dstAccess,
+        .dstStage = dstStage,
+        .staging = std::move(staging),
+        .memory = std::move(memory),
+    });
+  }
+
+  // Stages tightly packed texels for the whole of a single-mip colour image, which the graphics queue then samples from
+  // `dstStage` in SHADER_READ_ONLY_OPTIMAL. The image's previous contents are discarded.
+  void upload(Image const& dst, VkExtent2D extent, std::span<std::byte const> data, VkPipelineStageFlags dstStage) {
+    Buffer staging{device_, data.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT};
+    auto memory = allocator_.allocateAndBind(
+        staging, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    std::memcpy(memory.mapped(), data.data(), data.size());
+    pending_.push_back(Copy{
+        .dst = VK_NULL_HANDLE,
+        .image = dst,
+        .extent = extent,
+        .dstOffset = 0,
+        .size = data.size(),
+        .dstAccess = VK_ACCESS_SHADER_READ_BIT,
+        .dstStage = dstStage,
+        .staging = std::move(staging),
+        .memory = std::move(memory),
+    });
+  }
+
+  // Submits every staged copy, first waiting for the previous batch if it hasn't finished.
+  void submit() {
+    if (pending_.empty()) {
+      return;
+    }
+    done_.wait();
+    done_.reset();
+    inFlight_ = std::move(pending_);
+    pending_.clear();
+
+    auto const transferFamily = device_.transferQueue().familyIndex;
+    auto const graphicsFamily = device_.graphicsQueue().familyIndex;
+    auto const transfer = needsOwnershipTransfer();
+
+    std::vector<VkBufferMemoryBarrier> barriers;
+    std::vector<VkImageMemoryBarrier> imageBarriers;
+    std::vector<VkImageMemoryBarrier> toTransferDst;
+    VkPipelineStageFlags dstStages{};
+    for (auto const& copy : inFlight_) {
+      dstStages |= copy.dstStage;
+      if (copy.image != VK_NULL_HANDLE) {
+        VkImageMemoryBarrier barrier{
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = 0,
+            .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = copy.image,
+            .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+        };
+        toTransferDst.push_back(barrier);
+        // the layout transition happens once, between the release and the acquire, so both halves name it
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = transfer ? VkAccessFlags{} : copy.dstAccess;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcQueueFamilyIndex = transfer ? transferFamily : VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = transfer ? graphicsFamily : VK_QUEUE_FAMILY_IGNORED;
+        imageBarriers.push_back(barrier);
+        continue;
+      }
+      barriers.push_back(VkBufferMemoryBarrier{
+          .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+          .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+          .dstAccessMask = transfer ? VkAccessFlags{} : copy.dstAccess,
+          .srcQueueFamilyIndex = transfer ? transferFamily : VK_QUEUE_FAMILY_IGNORED,
+          .dstQueueFamilyIndex = transfer ? graphicsFamily : VK_QUEUE_FAMILY_IGNORED,
+          .buffer = copy.dst,
+          .offset = copy.dstOffset,
+          .size = copy.size,
+      });
+    }
+
+    record(transferCmd_, [&] {
+      if (!toTransferDst.empty()) {
+        vkCmdPipelineBarrier(
+            transferCmd_,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0,
+            0,
+            nullptr,
+            0,
+            nullptr,
+            static_cast<uint32_t>(toTransferDst.size()),
+            toTransferDst.data());
+      }
+      for (auto const& copy : inFlight_) {
+        if (copy.image != VK_NULL_HANDLE) {
+          VkBufferImageCopy region{
+              .bufferOffset = 0,
+              .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+              .imageExtent = {copy.extent.width, copy.extent.height, 1},
+          };
+          vkCmdCopyBufferToImage(
+              transferCmd_, copy.staging, copy.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+          continue;
+        }
+        VkBufferCopy region{.srcOffset = 0, .dstOffset = copy.dstOffset, .size = copy.size};
+        vkCmdCopyBuffer(transferCmd_, copy.staging, copy.dst, 1, &region);
+      }
+      // the release half only needs to order against the copies; its destination scope is ignored
+      vkCmdPipelineBarrier(
+          transferCmd_,
+          VK_PIPELINE_STAGE_TRANSFER_BIT,
+          transfer ? VkPipelineStageFlags{VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT} : dstStages,
+          0,
+          0,
+          nullptr,
+          static_cast<uint32_t>(barriers.size()),
+          barriers.data(),
+          static_cast<uint32_t>(imageBarriers.size()),
+          imageBarriers.data());
+    });
+
+    if (!transfer) {
+      VkSubmitInfo submitInfo{
+          .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+          .commandBufferCount = 1,
+          .pCommandBuffers = &transferCmd_,
+      };
+      if (vkQueueSubmit(device_.transferQueue().queue, 1, &submitInfo, done_) != VK_SUCCESS) {
+        throw std::runtime_error{"failed to submit upload"};
+      }
+      return;
+    }
+
+    // the acquire half repeats the release barriers exactly, with the destination access filled in
+    auto buffer = barriers.begin();
+    auto image = imageBarriers.begin();
+    for (auto const& copy : inFlight_) {
+      if (copy.image != VK_NULL_HANDLE) {
+        image->srcAccessMask = 0;
+        image++->dstAccessMask = copy.dstAccess;
+      } else {
+        buffer->srcAccessMask = 0;
+        buffer++->dstAccessMask = copy.dstAccess;
+      }
+    }
+    record(*acquireCmd_, [&] {
+      vkCmdPipelineBarrier(
+          *acquireCmd_,
+          VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+          dstStages,
+          0,
+          0,
+          nullptr,
+          static_cast<uint32_t>(barriers.size()),
+          barriers.data(),
+          static_cast<uint32_t>(imageBarriers.size()),
+          imageBarriers.data());
+    });
+
+    VkSubmitInfo transferSubmit{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &transferCmd_,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = copied_.ptr(),
+    };
+    if (vkQueueSubmit(device_.transferQueue().queue, 1, &transferSubmit, VK_NULL_HANDLE) != VK_SUCCESS) {
+      throw std::runtime_error{"failed to submit upload"};
+    }
+    VkSubmitInfo acquireSubmit{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .waitSemaphoreCount = 1,
+        .pWaitSemaphores = copied_.ptr(),
+        .pWaitDstStageMask = &dstStages,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &*acquireCmd_,
+    };
+    if (vkQueueSubmit(device_.graphicsQueue().queue, 1, &acquireSubmit, done_) != VK_SUCCESS) {
+      throw std::runtime_error{"failed to submit upload acquire"};
+    }
+  }
+
+  // Frees the last batch's staging memory if it has landed.
+  void collect() {
+    if (!inFlight_.empty() && done_.signaled()) {
+      inFlight_.clear();
+    }
+  }
+
+  void wait() {
+    done_.wait();
+    inFlight_.clear();
+  }
+
+ private:
+  struct Copy {
+    VkBuffer dst;       // either a buffer...
+    VkImage image;      // ...or a whole image
+    VkExtent2D extent;  // of `image`
+    VkDeviceSize dstOffset;
+    VkDeviceSize size;
+    VkAccessFlags dstAccess;
+    VkPipelineStageFlags dstStage;
+    Buffer staging;
+    Allocation memory;
+  };
+
+  bool needsOwnershipTransfer() const {
+    return device_.transferQueue().familyIndex != device_.graphicsQueue().familyIndex;
+  }
+
+  template <typename Commands> static void record(VkCommandBuffer cmd, Commands&& commands) {
+    vkResetCommandBuffer(cmd, {});
+    VkCommandBufferBeginInfo beginInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    if (vkBeginCommandBuffer(cmd, &beginInfo) != VK_SUCCESS) {
+      throw std::runtime_error{"failed to begin command buffer"};
+    }
+    commands();
+    if (vkEndCommandBuffer(cmd) != VK_SUCCESS) {
+      throw std::runtime_error{"failed to record command buffer"};
+    }
+  }
+
+  Device const& device_;
+  Allocator& allocator_;
+  CommandPool transferPool_;
+  VkCommandBuffer transferCmd_;
+  std::optional<CommandPool> acquirePool_;
+  std::optional<VkCommandBuffer> acquireCmd_;
+  Semaphore copied_;
+  Fence done_;
+  std::vector<Copy> pending_;
+  std::vector<Copy> inFlight_;
+};
+
+// A device-local buffer whose initial contents are staged into `uploader`; the caller submits it.
+struct UploadedBuffer {
+  UploadedBuffer(
+      VkDevice device,
+      Allocator& allocator,
+      Uploader& uploader,
+      std::span<std::byte const> data,
+      VkBufferUsageFlags usage,
+      VkAccessFlags dstAccess,
+      VkPipelineStageFlags dstStage)
+      : buffer{device, data.size(), usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT},
+        memory{allocator.allocateAndBind(buffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)} {
+    uploader.upload(buffer, data, dstAccess, dstStage);
+  }
+
+  Buffer buffer;
+  Allocation memory;
+};
+
+// A device-local RGBA8 texture whose texels are staged into `uploader`; the caller submits it. The graphics queue may
+// sample it, in SHADER_READ_ONLY_OPTIMAL, from `dstStage` once the upload has been acquired.
+struct UploadedTexture {
+  static constexpr VkFormat kFormat = VK_FORMAT_R8G8B8A8_UNORM;
+
+  UploadedTexture(
+      VkDevice device,
+      Allocator& allocator,
+      Uploader& uploader,
+      VkExtent2D extent,
+      std::span<std::byte const> texels,
+      VkPipelineStageFlags dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT)
+      : image{device, kFormat, extent, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT},
+        memory{allocator.allocateAndBind(image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)},
+        view{device, image, kFormat} {
+    if (texels.size() != VkDeviceSize{extent.width} * extent.height * 4) {
+      throw std::runtime_error{"texel data doesn't match texture size"};
+    }
+    uploader.upload(image, extent, texels, dstStage);
+  }
+
+  Image image;
+  Allocation memory;
+  ImageView view;
+};
+
+}  // namespace vk
\ No newline at end of file
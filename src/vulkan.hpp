@@ -1,18 +1,32 @@
 #pragma once
 
 #include <algorithm>
+#include <cctype>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <iomanip>
+#include <iostream>
 #include <iterator>
+#include <memory>
+#include <optional>
+#include <ranges>
 #include <set>
 #include <span>
+#include <sstream>
 #include <stdexcept>
+#include <string>
 #include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include <vulkan/vulkan.h>
 
 #include "glfw.hpp"
+#include "hostalloc.hpp"
+#include "mappedfile.hpp"
 #include "raii.hpp"
 
 namespace vk {
@@ -21,6 +35,15 @@ struct OutOfDateError : std::runtime_error {
   OutOfDateError() : runtime_error{""} {}
 };
 
+inline std::vector<uint8_t> readFile(std::filesystem::path const& path) {
+  std::ifstream in{path, std::ios::ate | std::ios::binary};
+  in.exceptions(std::ios::failbit | std::ios::badbit);
+  std::vector<uint8_t> data(in.tellg());
+  in.seekg(0, std::ios::beg);
+  in.read(reinterpret_cast<char*>(data.data()), data.size());
+  return data;
+}
+
 inline auto enumerateInstanceLayerProperties() {
   return raii::VecFetcher<VkLayerProperties, vkEnumerateInstanceLayerProperties>();
 }
@@ -45,6 +68,25 @@ inline auto getPhysicalDeviceFeatures(VkPhysicalDevice device) {
   return raii::Fetcher<VkPhysicalDeviceFeatures, vkGetPhysicalDeviceFeatures>(device);
 }
 
+inline auto getPhysicalDeviceMemoryProperties(VkPhysicalDevice device) {
+  return raii::Fetcher<VkPhysicalDeviceMemoryProperties, vkGetPhysicalDeviceMemoryProperties>(device);
+}
+
+inline auto getPhysicalDeviceFormatProperties(VkPhysicalDevice device, VkFormat format) {
+  return raii::Fetcher<VkFormatProperties, vkGetPhysicalDeviceFormatProperties>(device, format);
+}
+
+// Needs Vulkan 1.1 on both the instance and the device.
+inline auto getPhysicalDeviceIDProperties(VkPhysicalDevice device) {
+  VkPhysicalDeviceIDProperties idProps{.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES};
+  VkPhysicalDeviceProperties2 props{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+      .pNext = &idProps,
+  };
+  vkGetPhysicalDeviceProperties2(device, &props);
+  return idProps;
+}
+
 inline auto getPhysicalDeviceQueueFamilyProperties(VkPhysicalDevice device) {
   return raii::VecFetcher<VkQueueFamilyProperties, vkGetPhysicalDeviceQueueFamilyProperties>(device);
 }
@@ -87,20 +129,68 @@ inline auto acquireNextImageKHR(VkDevice device, VkSwapchainKHR swapchain, VkSem
   }
 }
 
-struct Instance : raii::UniqueHandle<Instance, VkInstance> {
-  struct Functionality {
-    std::vector<char const*> required;
-    std::vector<char const*> optional;
-  };
+// Everything device selection and swapchain creation ask a physical device about, queried once. Drivers can be slow to
+// answer, so a Device keeps the snapshot of the one it picked for the swapchain, allocator, etc. to reuse rather than
+// asking again. The surface parts are empty, and every family is taken to present, when there is no surface.
+struct PhysicalDeviceInfo {
+  PhysicalDeviceInfo(VkPhysicalDevice physDevice, VkSurfaceKHR surface)
+      : physDevice{physDevice},
+        surface{surface},
+        properties{getPhysicalDeviceProperties(physDevice)},
+        features{getPhysicalDeviceFeatures(physDevice)},
+        memoryProperties{getPhysicalDeviceMemoryProperties(physDevice)} {
+    raii::VecFetcherInto<vkEnumerateDeviceExtensionProperties>(extensions, physDevice, nullptr);
+    raii::VecFetcherInto<vkGetPhysicalDeviceQueueFamilyProperties>(queueFamilies, physDevice);
+    presentSupport.resize(queueFamilies.size(), VK_TRUE);
+    if (surface) {
+      raii::VecFetcherInto<vkGetPhysicalDeviceSurfaceFormatsKHR>(surfaceFormats, physDevice, surface);
+      raii::VecFetcherInto<vkGetPhysicalDeviceSurfacePresentModesKHR>(presentModes, physDevice, surface);
+      for (uint32_t i{}; i < queueFamilies.size(); i++) {
+        presentSupport[i] = getPhysicalDeviceSurfaceSupportKHR(physDevice, i, surface);
+      }
+    }
+  }
+
+  bool hasExtension(std::string_view name) const {
+    return std::ranges::any_of(extensions, [&](auto const& ext) { return name == ext.extensionName; });
+  }
 
-  Instance(char const* name, Functionality extensions = {}, Functionality layers = {})
-      : UniqueHandle{[&] {
+  VkPhysicalDevice physDevice;
+  VkSurfaceKHR surface;
+  VkPhysicalDeviceProperties properties;
+  VkPhysicalDeviceFeatures features;
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  std::vector<VkExtensionProperties> extensions;
+  std::vector<VkQueueFamilyProperties> queueFamilies;
+  std::vector<VkBool32> presentSupport;  // per queue family
+  std::vector<VkSurfaceFormatKHR> surfaceFormats;
+  std::vector<VkPresentModeKHR> presentModes;
+};
+
+// Not exported by the loader, like every VK_EXT_debug_utils entry point.
+inline void destroyDebugUtilsMessenger(
+    VkInstance instance, VkDebugUtilsMessengerEXT messenger, VkAllocationCallbacks const* callbacks) {
+  if (auto destroy = reinterpret_cast<PFN_vkDestroyDebugUtilsMessengerEXT>(
+          vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT"))) {
+    destroy(instance, messenger, callbacks);
+  }
+}
+
+struct Functionality {
+  std::vector<char const*> required;
+  std::vector<char const*> optional;
+};
+
+struct Instance : raii::UniqueHandle<Instance, VkInstance> {
+  // `next` is chained onto the create info, e.g. a VkDebugUtilsMessengerCreateInfoEXT to hear about the instance's own
+  // creation and destruction.
+  Instance(char const* name, Functionality extensions = {}, Functionality layers = {}, void const* next = nullptr)
+      : Instance{[&] {
           using namespace optalg;
           using namespace std::views;
 
           auto enabledExtensions =
               std::array{
-                  glfw::getRequiredInstanceExtensions() | to<std::vector>(),
                   std::move(extensions.required),
                   std::move(extensions.optional) |
                       filter([avail = enumerateInstanceExtensionProperties()](auto const& opt) {
@@ -119,14 +209,23 @@ struct Instance : raii::UniqueHandle<Instance, VkInstance> {
                   }) | to<std::vector>()} |
               join | to<std::vector>();
 
+          // ask for 1.2 where the loader can give it to us; devices still report (and are limited to) their own version
+          uint32_t apiVersion{VK_API_VERSION_1_0};
+          if (auto enumerateInstanceVersion = reinterpret_cast<PFN_vkEnumerateInstanceVersion>(
+                  vkGetInstanceProcAddr(nullptr, "vkEnumerateInstanceVersion"))) {
+            enumerateInstanceVersion(&apiVersion);
+          }
+          apiVersion = std::min(apiVersion, VK_API_VERSION_1_2);
+
           VkApplicationInfo appInfo{
               .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
               .pApplicationName = name,
               .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
-              .apiVersion = VK_API_VERSION_1_0,
+              .apiVersion = apiVersion,
           };
           VkInstanceCreateInfo createInfo{
               .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+              .pNext = next,
               .pApplicationInfo = &appInfo,
               .enabledLayerCount = static_cast<uint32_t>(enabledLayers.size()),
               .ppEnabledLayerNames = enabledLayers.data(),
@@ -135,16 +234,91 @@ struct Instance : raii::UniqueHandle<Instance, VkInstance> {
           };
 
           VkInstance instance{};
-          if (vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS) {
+          auto const callbacks = HostAllocator::get().callbacks(VK_OBJECT_TYPE_INSTANCE);
+          if (vkCreateInstance(&createInfo, callbacks, &instance) != VK_SUCCESS) {
             throw std::runtime_error{"failed to create instance"};
           }
-          return instance;
+          return Instance{instance, callbacks, apiVersion, {enabledExtensions.begin(), enabledExtensions.end()}};
         }()} {}
 
+  uint32_t apiVersion() const {
+    return apiVersion_;
+  }
+
+  bool hasExtension(std::string_view name) const {
+    return std::ranges::find(enabledExtensions_, name) != enabledExtensions_.cend();
+  }
+
  private:
   friend UniqueHandle<Instance, VkInstance>;
   void destroy(VkInstance instance) {
-    vkDestroyInstance(instance, nullptr);
+    vkDestroyInstance(instance, callbacks_);
+  }
+
+  Instance(
+      VkInstance instance,
+      VkAllocationCallbacks const* callbacks,
+      uint32_t apiVersion,
+      std::vector<std::string> enabledExtensions)
+      : UniqueHandle{instance},
+        callbacks_{callbacks},
+        apiVersion_{apiVersion},
+        enabledExtensions_{std::move(enabledExtensions)} {}
+
+  VkAllocationCallbacks const* callbacks_;
+  uint32_t apiVersion_;
+  std::vector<std::string> enabledExtensions_;
+};
+
+// Prints VK_EXT_debug_utils messages (validation errors, mostly) of `minSeverity` and up to stderr. Objects named with
+// Device::setName are reported by name. The layers only report anything once the messenger exists, so
+// `createInfo` is also for chaining onto the instance itself.
+struct DebugMessenger : raii::ParentedUniqueHandle<VkDebugUtilsMessengerEXT, destroyDebugUtilsMessenger, VkInstance> {
+  DebugMessenger(VkInstance instance, VkDebugUtilsMessageSeverityFlagBitsEXT minSeverity)
+      : ParentedUniqueHandle{[&] {
+          auto create = reinterpret_cast<PFN_vkCreateDebugUtilsMessengerEXT>(
+              vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT"));
+          auto createInfo = DebugMessenger::createInfo(minSeverity);
+          VkDebugUtilsMessengerEXT messenger{};
+          auto const callbacks = HostAllocator::get().callbacks(VK_OBJECT_TYPE_DEBUG_UTILS_MESSENGER_EXT);
+          if (!create || create(instance, &createInfo, callbacks, &messenger) != VK_SUCCESS) {
+            throw std::runtime_error{"failed to create debug messenger"};
+          }
+          return std::tuple{instance, messenger, callbacks};
+        }()} {}
+
+  static VkDebugUtilsMessengerCreateInfoEXT createInfo(VkDebugUtilsMessageSeverityFlagBitsEXT minSeverity) {
+    VkDebugUtilsMessageSeverityFlagsEXT severities{};
+    for (auto severity :
+         {VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT,
+          VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT,
+          VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT,
+          VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT}) {
+      if (severity >= minSeverity) {
+        severities |= severity;
+      }
+    }
+    return VkDebugUtilsMessengerCreateInfoEXT{
+        .sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT,
+        .messageSeverity = severities,
+        .messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
+                       VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT,
+        .pfnUserCallback = &print,
+    };
+  }
+
+ private:
+  static VkBool32 VKAPI_PTR print(
+      VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+      VkDebugUtilsMessageTypeFlagsEXT,
+      VkDebugUtilsMessengerCallbackDataEXT const* data,
+      void*) {
+    auto const* level = severity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT     ? "error"
+                        : severity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT ? "warning"
+                        : severity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT    ? "info"
+                                                                                      : "verbose";
+    std::cerr << "vulkan " << level << ": " << data->pMessage << '\n';
+    return VK_FALSE;  // never abort the call that triggered it
   }
 };
 
@@ -155,43 +329,109 @@ struct Queue {
 };
 
 struct Device : raii::UniqueHandle<Device, VkDevice> {
-  Device(VkInstance instance, VkSurfaceKHR surface, std::span<char const* const> requiredExtensions = {})
+  // Capabilities beyond core 1.0 that are turned on whenever the selected device supports them.
+  struct Features {
+    bool timelineSemaphore{};
+    bool multiDrawIndirect{};
+    bool drawIndirectFirstInstance{};
+    bool dynamicRendering{};  // needs VK_KHR_dynamic_rendering in the optional extensions
+    bool presentWait{};       // needs both VK_KHR_present_id and VK_KHR_present_wait
+    // the parts of descriptor indexing (core in 1.2) that bindless textures need: partially bound runtime arrays of
+    // sampled images, updated after being bound, and indexed non-uniformly
+    bool descriptorIndexing{};
+  };
+
+  // Entry points of enabled device extensions, which the loader doesn't export. Null unless enabled.
+  struct Dispatch {
+    PFN_vkCmdBeginRenderingKHR cmdBeginRendering{};
+    PFN_vkCmdEndRenderingKHR cmdEndRendering{};
+    PFN_vkWaitForPresentKHR waitForPresent{};
+    PFN_vkSetDebugUtilsObjectNameEXT setObjectName{};  // needs VK_EXT_debug_utils on the instance
+  };
+
+  // A null `surface` selects a device for headless rendering: no present support is required and the present queue is
+  // just the graphics queue. Of the devices that qualify, the best by score() is chosen, unless `selector` is given:
+  // then only a device whose name contains it, or whose UUID it is, will do.
+  Device(Instance const& instance, VkSurfaceKHR surface, Functionality extensions = {}, std::string_view selector = {})
       : Device{[&] {
-          auto const& [physDevice, gfxQueueIdx, presentQueueIdx] = [&] {
+          auto [info, gfxQueueIdx, presentQueueIdx, transferQueueIdx] = [&] {
+            std::optional<std::tuple<PhysicalDeviceInfo, uint32_t, uint32_t, uint32_t>> best;
+            uint64_t bestScore{};
+            std::string seen;
             for (auto const& physDevice : enumeratePhysicalDevices(instance)) {
-              if (!std::ranges::all_of(
-                      requiredExtensions,
-                      [availableExtensions = enumerateDeviceExtensionProperties(physDevice)](auto const& req) {
-                        return std::ranges::any_of(
-                            availableExtensions,
-                            [svReq = std::string_view{req}](auto const& ext) { return svReq == ext.extensionName; });
-                      })) {
+              PhysicalDeviceInfo info{physDevice, surface};
+              seen += seen.empty() ? "" : ", ";
+              seen += info.properties.deviceName;
+              if (!selector.empty() && !matches(instance, info, selector)) {
+                continue;
+              }
+
+              if (!std::ranges::all_of(extensions.required, [&](auto const& req) { return info.hasExtension(req); })) {
                 continue;
               }
 
-              if (getPhysicalDeviceSurfacePresentModesKHR(physDevice, surface).empty() ||
-                  getPhysicalDeviceSurfaceFormatsKHR(physDevice, surface).empty()) {
+              if (surface && (info.presentModes.empty() || info.surfaceFormats.empty())) {
                 continue;
               }
 
-              auto queueFamilies = getPhysicalDeviceQueueFamilyProperties(physDevice);
-              auto gfxQueue = std::ranges::find_if(
-                  queueFamilies, [](auto const& qf) { return qf.queueFlags & VK_QUEUE_GRAPHICS_BIT; });
-              if (gfxQueue == queueFamilies.cend()) {
+              // one family that does both graphics and present saves handing every frame's image from one to the
+              // other, so take the first graphics family that can present if there is one
+              auto const& queueFamilies = info.queueFamilies;
+              auto presents = [&](uint32_t i) { return info.presentSupport[i] == VK_TRUE; };
+              std::optional<uint32_t> gfxQueueIdx;
+              std::optional<uint32_t> presentQueueIdx;
+              for (uint32_t i{}; i < queueFamilies.size() && !presentQueueIdx; i++) {
+                if (queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+                  gfxQueueIdx = gfxQueueIdx.value_or(i);
+                  if (presents(i)) {
+                    gfxQueueIdx = presentQueueIdx = i;
+                  }
+                }
+              }
+              for (uint32_t i{}; i < queueFamilies.size() && !presentQueueIdx; i++) {
+                if (presents(i)) {
+                  presentQueueIdx = i;
+                }
+              }
+              if (!gfxQueueIdx || !presentQueueIdx) {
                 continue;
               }
-              for (uint32_t i{}; i < queueFamilies.size(); i++) {
-                if (getPhysicalDeviceSurfaceSupportKHR(physDevice, i, surface)) {
-                  return std::tuple{
-                      physDevice, static_cast<uint32_t>(std::distance(queueFamilies.begin(), gfxQueue)), i};
+
+              // uploads go to a transfer-only family (usually a dedicated DMA engine) so they can run alongside
+              // rendering, then to any transfer-capable family without graphics, and only then share graphics
+              auto familyWhere = [&](VkQueueFlags required, VkQueueFlags excluded) -> std::optional<uint32_t> {
+                for (uint32_t i{}; i < queueFamilies.size(); i++) {
+                  auto flags = queueFamilies[i].queueFlags;
+                  if ((flags & required) == required && !(flags & excluded)) {
+                    return i;
+                  }
                 }
+                return std::nullopt;
+              };
+              auto transferQueueIdx =
+                  familyWhere(VK_QUEUE_TRANSFER_BIT, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)
+                      .value_or(familyWhere(VK_QUEUE_TRANSFER_BIT, VK_QUEUE_GRAPHICS_BIT).value_or(*gfxQueueIdx));
+
+              auto deviceScore =
+                  score(info, supportsDescriptorIndexing(instance, info), *gfxQueueIdx == *presentQueueIdx);
+              if (!best || deviceScore > bestScore) {
+                best = std::tuple{std::move(info), *gfxQueueIdx, *presentQueueIdx, transferQueueIdx};
+                bestScore = deviceScore;
               }
             }
-            throw std::runtime_error{"no gpu supporting graphics queue"};
+            if (!best && !selector.empty()) {
+              throw std::runtime_error{
+                  "no suitable gpu matching \"" + std::string{selector} + "\" (found: " + seen + ")"};
+            }
+            if (!best) {
+              throw std::runtime_error{"no gpu supporting graphics queue"};
+            }
+            return std::move(*best);
           }();
+          auto const physDevice = info.physDevice;
 
           float const prio{1.0};
-          std::set<uint32_t> qIdxs{gfxQueueIdx, presentQueueIdx};
+          std::set<uint32_t> qIdxs{gfxQueueIdx, presentQueueIdx, transferQueueIdx};
           std::vector<VkDeviceQueueCreateInfo> queueCreateInfos{};
           std::transform(qIdxs.cbegin(), qIdxs.cend(), std::back_inserter(queueCreateInfos), [&](auto idx) {
             return VkDeviceQueueCreateInfo{
@@ -202,26 +442,147 @@ struct Device : raii::UniqueHandle<Device, VkDevice> {
             };
           });
 
-          VkPhysicalDeviceFeatures deviceFeatures{};
+          auto enabledExtensions =
+              std::array{
+                  std::move(extensions.required),
+                  std::move(extensions.optional) |
+                      std::views::filter([&info = info](auto const& opt) { return info.hasExtension(opt); }) |
+                      optalg::to<std::vector>()} |
+              std::views::join | optalg::to<std::vector>();
+          auto isEnabled = [&](std::string_view name) {
+            return std::ranges::find(enabledExtensions, name) != enabledExtensions.cend();
+          };
+
+          auto apiVersion = std::min(instance.apiVersion(), info.properties.apiVersion);
+          VkPhysicalDeviceVulkan12Features supported12{.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES};
+          VkPhysicalDeviceDynamicRenderingFeaturesKHR supportedDynamicRendering{
+              .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR};
+          VkPhysicalDevicePresentIdFeaturesKHR supportedPresentId{
+              .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR};
+          VkPhysicalDevicePresentWaitFeaturesKHR supportedPresentWait{
+              .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR};
+          if (apiVersion >= VK_API_VERSION_1_2) {
+            void* supportedChain{};
+            auto query = [&](auto& featureStruct) {
+              featureStruct.pNext = std::exchange(supportedChain, &featureStruct);
+            };
+            query(supported12);
+            if (isEnabled(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME)) {
+              query(supportedDynamicRendering);
+            }
+            if (isEnabled(VK_KHR_PRESENT_ID_EXTENSION_NAME) && isEnabled(VK_KHR_PRESENT_WAIT_EXTENSION_NAME)) {
+              query(supportedPresentId);
+              query(supportedPresentWait);
+            }
+            VkPhysicalDeviceFeatures2 supported{
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+                .pNext = supportedChain,
+            };
+            vkGetPhysicalDeviceFeatures2(physDevice, &supported);
+          }
+          auto const& supported10 = info.features;
+          Features features{
+              .timelineSemaphore = supported12.timelineSemaphore == VK_TRUE,
+              .multiDrawIndirect = supported10.multiDrawIndirect == VK_TRUE,
+              .drawIndirectFirstInstance = supported10.drawIndirectFirstInstance == VK_TRUE,
+              // only queried from 1.2 up, where everything the extension depends on is core
+              .dynamicRendering = supportedDynamicRendering.dynamicRendering == VK_TRUE,
+              .presentWait = supportedPresentId.presentId == VK_TRUE && supportedPresentWait.presentWait == VK_TRUE,
+              .descriptorIndexing = descriptorIndexing(supported12),
+          };
+
+          void* featureChain{};
+          auto chain = [&](auto& featureStruct) {
+            featureStruct.pNext = std::exchange(featureChain, &featureStruct);
+          };
+
+          VkPhysicalDeviceSwapchainMaintenance1FeaturesEXT swapchainMaintenance1Features{
+              .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SWAPCHAIN_MAINTENANCE_1_FEATURES_EXT,
+              .swapchainMaintenance1 = true,
+          };
+          if (isEnabled(VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME)) {
+            chain(swapchainMaintenance1Features);
+          }
+
+          VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures{
+              .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR,
+              .dynamicRendering = true,
+          };
+          if (features.dynamicRendering) {
+            chain(dynamicRenderingFeatures);
+          }
+
+          VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures{
+              .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR,
+              .presentId = true,
+          };
+          VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{
+              .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR,
+              .presentWait = true,
+          };
+          if (features.presentWait) {
+            chain(presentIdFeatures);
+            chain(presentWaitFeatures);
+          }
+
+          VkPhysicalDeviceVulkan12Features enabled12{
+              .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+              .shaderSampledImageArrayNonUniformIndexing = features.descriptorIndexing,
+              .descriptorBindingSampledImageUpdateAfterBind = features.descriptorIndexing,
+              .descriptorBindingUpdateUnusedWhilePending = features.descriptorIndexing,
+              .descriptorBindingPartiallyBound = features.descriptorIndexing,
+              .runtimeDescriptorArray = features.descriptorIndexing,
+              .timelineSemaphore = features.timelineSemaphore,
+          };
+          if (apiVersion >= VK_API_VERSION_1_2) {
+            chain(enabled12);
+          }
+
+          VkPhysicalDeviceFeatures deviceFeatures{
+              .multiDrawIndirect = features.multiDrawIndirect,
+              .drawIndirectFirstInstance = features.drawIndirectFirstInstance,
+          };
           VkDeviceCreateInfo createInfo{
               .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+              .pNext = featureChain,
               .queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size()),
               .pQueueCreateInfos = queueCreateInfos.data(),
-              .enabledExtensionCount = static_cast<uint32_t>(requiredExtensions.size()),
-              .ppEnabledExtensionNames = requiredExtensions.data(),
+              .enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size()),
+              .ppEnabledExtensionNames = enabledExtensions.data(),
               .pEnabledFeatures = &deviceFeatures,
           };
 
           VkDevice device{};
-          if (vkCreateDevice(physDevice, &createInfo, nullptr, &device) != VK_SUCCESS) {
+          auto const callbacks = HostAllocator::get().callbacks(VK_OBJECT_TYPE_DEVICE);
+          if (vkCreateDevice(physDevice, &createInfo, callbacks, &device) != VK_SUCCESS) {
             throw std::runtime_error{"failed to create logical device"};
           }
 
-          return Device{device, physDevice, Queue{device, gfxQueueIdx}, Queue{device, presentQueueIdx}};
+          PFN_vkSetDebugUtilsObjectNameEXT setObjectName{};
+          if (instance.hasExtension(VK_EXT_DEBUG_UTILS_EXTENSION_NAME)) {
+            setObjectName = reinterpret_cast<PFN_vkSetDebugUtilsObjectNameEXT>(
+                vkGetInstanceProcAddr(instance, "vkSetDebugUtilsObjectNameEXT"));
+          }
+
+          return Device{
+              device,
+              callbacks,
+              std::move(info),
+              Queue{device, gfxQueueIdx},
+              Queue{device, presentQueueIdx},
+              Queue{device, transferQueueIdx},
+              {enabledExtensions.begin(), enabledExtensions.end()},
+              features,
+              setObjectName};
         }()} {}
 
   VkPhysicalDevice physicalDevice() const {
-    return physDevice_;
+    return info_.physDevice;
+  }
+
+  // What the device reported when it was selected, for its surface if it was given one.
+  PhysicalDeviceInfo const& physicalDeviceInfo() const {
+    return info_;
   }
 
   Queue graphicsQueue() const {
@@ -232,36 +593,205 @@ struct Device : raii::UniqueHandle<Device, VkDevice> {
     return presentQueue_;
   }
 
+  // Same as the graphics queue when the device has no separate transfer-capable family.
+  Queue transferQueue() const {
+    return transferQueue_;
+  }
+
+  bool hasExtension(std::string_view name) const {
+    return std::ranges::find(enabledExtensions_, name) != enabledExtensions_.cend();
+  }
+
+  Features const& features() const {
+    return features_;
+  }
+
+  Dispatch const& dispatch() const {
+    return dispatch_;
+  }
+
+  // Names an object for validation messages and graphics debuggers. Does nothing unless the instance has
+  // VK_EXT_debug_utils, so it costs nothing in builds that don't ask for it.
+  template <typename Handle> void setName(Handle handle, VkObjectType type, char const* name) const {
+    if (!dispatch_.setObjectName) {
+      return;
+    }
+    VkDebugUtilsObjectNameInfoEXT info{
+        .sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_OBJECT_NAME_INFO_EXT,
+        .objectType = type,
+        // dispatchable handles are pointers, and so are non-dispatchable ones on 64-bit platforms
+        .objectHandle = [&] {
+          if constexpr (std::is_pointer_v<Handle>) {
+            return reinterpret_cast<uint64_t>(handle);
+          } else {
+            return static_cast<uint64_t>(handle);
+          }
+        }(),
+        .pObjectName = name,
+    };
+    dispatch_.setObjectName(*this, &info);
+  }
+
  private:
   friend UniqueHandle<Device, VkDevice>;
   void destroy(VkDevice device) {
-    vkDestroyDevice(device, nullptr);
+    vkDestroyDevice(device, callbacks_);
   }
 
-  explicit Device(VkDevice device, VkPhysicalDevice physDevice, Queue graphicsQueue, Queue presentQueue)
-      : UniqueHandle{device}, physDevice_{physDevice}, graphicsQueue_{graphicsQueue}, presentQueue_{presentQueue} {}
+  // Higher is better. Support for descriptor indexing dominates, since bindless rendering can't do without it, then
+  // the device type (discrete over integrated over everything else), then whether one queue family does both graphics
+  // and present, then the size of the largest device-local heap.
+  static uint64_t score(PhysicalDeviceInfo const& info, bool descriptorIndexing, bool sharedPresent) {
+    uint64_t typeRank{};
+    switch (info.properties.deviceType) {
+      case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+        typeRank = 3;
+        break;
+      case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+        typeRank = 2;
+        break;
+      case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+        typeRank = 1;
+        break;
+      default:
+        break;
+    }
+    auto const& memProps = info.memoryProperties;
+    VkDeviceSize localHeap{};
+    for (uint32_t i{}; i < memProps.memoryHeapCount; i++) {
+      if (memProps.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+        localHeap = std::max(localHeap, memProps.memoryHeaps[i].size);
+      }
+    }
+    auto localMiB = std::min<uint64_t>(localHeap >> 20, (uint64_t{1} << 60) - 1);
+    return uint64_t{descriptorIndexing} << 63 | typeRank << 61 | uint64_t{sharedPresent} << 60 | localMiB;
+  }
 
-  VkPhysicalDevice physDevice_;
+  // Whether `info` has every descriptor indexing feature Features::descriptorIndexing stands for; only queried from 1.2
+  // up, where they are core.
+  static bool supportsDescriptorIndexing(Instance const& instance, PhysicalDeviceInfo const& info) {
+    if (std::min(instance.apiVersion(), info.properties.apiVersion) < VK_API_VERSION_1_2) {
+      return false;
+    }
+    VkPhysicalDeviceVulkan12Features supported12{.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES};
+    VkPhysicalDeviceFeatures2 supported{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &supported12,
+    };
+    vkGetPhysicalDeviceFeatures2(info.physDevice, &supported);
+    return descriptorIndexing(supported12);
+  }
+
+  static bool descriptorIndexing(VkPhysicalDeviceVulkan12Features const& supported12) {
+    return supported12.runtimeDescriptorArray == VK_TRUE && supported12.descriptorBindingPartiallyBound == VK_TRUE &&
+           supported12.descriptorBindingSampledImageUpdateAfterBind == VK_TRUE &&
+           supported12.descriptorBindingUpdateUnusedWhilePending == VK_TRUE &&
+           supported12.shaderSampledImageArrayNonUniformIndexing == VK_TRUE;
+  }
+
+  // `selector` is part of the device name, or its UUID as 32 hex digits (dashes and case don't matter).
+  static bool matches(Instance const& instance, PhysicalDeviceInfo const& info, std::string_view selector) {
+    if (std::string_view{info.properties.deviceName}.find(selector) != std::string_view::npos) {
+      return true;
+    }
+    if (std::min(instance.apiVersion(), info.properties.apiVersion) < VK_API_VERSION_1_1) {
+      return false;
+    }
+    std::string wanted;
+    for (auto c : selector) {
+      if (c != '-') {
+        wanted += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+      }
+    }
+    std::ostringstream uuid;
+    uuid << std::hex << std::setfill('0');
+    for (auto b : getPhysicalDeviceIDProperties(info.physDevice).deviceUUID) {
+      uuid << std::setw(2) << static_cast<unsigned>(b);
+    }
+    return uuid.str() == wanted;
+  }
+
+  explicit Device(
+      VkDevice device,
+      VkAllocationCallbacks const* callbacks,
+      PhysicalDeviceInfo info,
+      Queue graphicsQueue,
+      Queue presentQueue,
+      Queue transferQueue,
+      std::vector<std::string> enabledExtensions,
+      Features features,
+      PFN_vkSetDebugUtilsObjectNameEXT setObjectName)
+      : UniqueHandle{device},
+        callbacks_{callbacks},
+        info_{std::move(info)},
+        graphicsQueue_{graphicsQueue},
+        presentQueue_{presentQueue},
+        transferQueue_{transferQueue},
+        enabledExtensions_{std::move(enabledExtensions)},
+        features_{features},
+        dispatch_{[&] {
+          Dispatch dispatch{.setObjectName = setObjectName};
+          if (features.dynamicRendering) {
+            dispatch.cmdBeginRendering = reinterpret_cast<PFN_vkCmdBeginRenderingKHR>(
+                vkGetDeviceProcAddr(device, "vkCmdBeginRenderingKHR"));
+            dispatch.cmdEndRendering =
+                reinterpret_cast<PFN_vkCmdEndRenderingKHR>(vkGetDeviceProcAddr(device, "vkCmdEndRenderingKHR"));
+          }
+          if (features.presentWait) {
+            dispatch.waitForPresent =
+                reinterpret_cast<PFN_vkWaitForPresentKHR>(vkGetDeviceProcAddr(device, "vkWaitForPresentKHR"));
+          }
+          return dispatch;
+        }()} {}
+
+  VkAllocationCallbacks const* callbacks_;
+  PhysicalDeviceInfo info_;
   Queue graphicsQueue_;
   Queue presentQueue_;
+  Queue transferQueue_;
+  std::vector<std::string> enabledExtensions_;
+  Features features_;
+  Dispatch dispatch_;
 };
 
 struct Surface : raii::ParentedUniqueHandle<VkSurfaceKHR, vkDestroySurfaceKHR, VkInstance> {
   Surface(VkInstance instance, GLFWwindow* window)
       : ParentedUniqueHandle{[&] {
           VkSurfaceKHR surface{};
-          if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS) {
+          auto const callbacks = HostAllocator::get().callbacks(VK_OBJECT_TYPE_SURFACE_KHR);
+          if (glfwCreateWindowSurface(instance, window, callbacks, &surface) != VK_SUCCESS) {
             throw std::runtime_error{"failed to create window surface"};
           }
-          return std::tuple{instance, surface, nullptr};
+          return std::tuple{instance, surface, callbacks};
         }()} {}
 };
 
+// How the swapchain trades latency against tearing and power.
+enum class PresentPolicy {
+  Mailbox,      // MAILBOX (else FIFO) with one image over the minimum: no tearing, renders as fast as it can
+  LowLatency,   // IMMEDIATE, else MAILBOX, else FIFO, with as few images as the surface allows
+  Fifo,         // FIFO: vsync, and the GPU idles between frames
+  FifoRelaxed,  // FIFO_RELAXED (else FIFO): vsync, but a late frame tears instead of waiting another refresh
+};
+
 struct Swapchain : raii::ParentedUniqueHandle<VkSwapchainKHR, vkDestroySwapchainKHR, VkDevice> {
-  Swapchain(GLFWwindow* window, Device const& device, VkSurfaceKHR surface, VkSwapchainKHR oldSwapchain = {})
+  Swapchain(
+      GLFWwindow* window,
+      Device const& device,
+      VkSurfaceKHR surface,
+      VkSwapchainKHR oldSwapchain = {},
+      PresentPolicy policy = PresentPolicy::Mailbox)
       : Swapchain{[&] {
+          // formats and present modes don't change with the window, so unless this is a different surface from the one
+          // the device was selected for, only the capabilities (extent, image counts) need asking for again
+          auto const& info = device.physicalDeviceInfo();
+          std::optional<PhysicalDeviceInfo> fresh;
+          if (surface != info.surface) {
+            fresh.emplace(device.physicalDevice(), surface);
+          }
+          auto const& surfaceInfo = fresh ? *fresh : info;
           auto surfaceFormat = [&] {
-            auto formats = getPhysicalDeviceSurfaceFormatsKHR(device.physicalDevice(), surface);
+            auto const& formats = surfaceInfo.surfaceFormats;
             return optalg::find_if(
                        formats,
                        [](auto const& format) {
@@ -271,13 +801,38 @@ struct Swapchain : raii::ParentedUniqueHandle<VkSwapchainKHR, vkDestroySwapchain
                 .value_or(formats.front());
           }();
           auto caps = getPhysicalDeviceSurfaceCapabilitiesKHR(device.physicalDevice(), surface);
-          auto queueFamilies = std::set{device.graphicsQueue().familyIndex, device.presentQueue().familyIndex} |
-                               optalg::to<std::vector>();
+
+          auto presentMode = [&] {
+            auto const& modes = surfaceInfo.presentModes;
+            auto firstAvailable = [&](std::initializer_list<VkPresentModeKHR> preferred) {
+              for (auto mode : preferred) {
+                if (std::ranges::find(modes, mode) != modes.end()) {
+                  return mode;
+                }
+              }
+              return VK_PRESENT_MODE_FIFO_KHR;  // always supported
+            };
+            switch (policy) {
+              case PresentPolicy::LowLatency:
+                return firstAvailable({VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR});
+              case PresentPolicy::Fifo:
+                return VK_PRESENT_MODE_FIFO_KHR;
+              case PresentPolicy::FifoRelaxed:
+                return firstAvailable({VK_PRESENT_MODE_FIFO_RELAXED_KHR});
+              case PresentPolicy::Mailbox:
+                break;
+            }
+            return firstAvailable({VK_PRESENT_MODE_MAILBOX_KHR});
+          }();
+          auto imageCount = policy == PresentPolicy::LowLatency ? caps.minImageCount : caps.minImageCount + 1;
+          if (caps.maxImageCount != 0) {  // 0 means no limit
+            imageCount = std::min(imageCount, caps.maxImageCount);
+          }
 
           VkSwapchainCreateInfoKHR createInfo{
               .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
               .surface = surface,
-              .minImageCount = (caps.minImageCount == caps.maxImageCount) ? caps.maxImageCount : caps.minImageCount + 1,
+              .minImageCount = imageCount,
               .imageFormat = surfaceFormat.format,
               .imageColorSpace = surfaceFormat.colorSpace,
               .imageExtent =
@@ -293,29 +848,29 @@ struct Swapchain : raii::ParentedUniqueHandle<VkSwapchainKHR, vkDestroySwapchain
                   }(),
               .imageArrayLayers = 1,
               .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-              .imageSharingMode = queueFamilies.size() > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
-              .queueFamilyIndexCount = queueFamilies.size() > 1 ? static_cast<uint32_t>(queueFamilies.size()) : 0,
-              .pQueueFamilyIndices = queueFamilies.size() > 1 ? queueFamilies.data() : nullptr,
+              // even when presenting from another family: concurrent sharing can cost the images their compression,
+              // so the renderer transfers ownership instead
+              .imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
               .preTransform = caps.currentTransform,
               .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
-              .presentMode = optalg::find_if(
-                                 getPhysicalDeviceSurfacePresentModesKHR(device.physicalDevice(), surface),
-                                 [](auto const& mode) { return mode == VK_PRESENT_MODE_MAILBOX_KHR; })
-                                 .value_or(VK_PRESENT_MODE_FIFO_KHR),
+              .presentMode = presentMode,
               .clipped = true,
               .oldSwapchain = oldSwapchain,
           };
 
           VkSwapchainKHR swapchain;
-          if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapchain) != VK_SUCCESS) {
+          auto const callbacks = HostAllocator::get().callbacks(VK_OBJECT_TYPE_SWAPCHAIN_KHR);
+          if (vkCreateSwapchainKHR(device, &createInfo, callbacks, &swapchain) != VK_SUCCESS) {
             throw std::runtime_error{"failed to create swapchain"};
           }
           return Swapchain{
               device,
               swapchain,
+              callbacks,
               getSwapchainImagesKHR(device, swapchain),
               createInfo.imageFormat,
-              createInfo.imageExtent};
+              createInfo.imageExtent,
+              createInfo.presentMode};
         }()} {}
 
   std::vector<VkImage> const& images() const {
@@ -330,20 +885,33 @@ struct Swapchain : raii::ParentedUniqueHandle<VkSwapchainKHR, vkDestroySwapchain
     return extent_;
   }
 
+  VkPresentModeKHR presentMode() const {
+    return presentMode_;
+  }
+
  private:
-  Swapchain(VkDevice device, VkSwapchainKHR swapchain, std::vector<VkImage> images, VkFormat format, VkExtent2D extent)
-      : ParentedUniqueHandle{device, swapchain, nullptr},
+  Swapchain(
+      VkDevice device,
+      VkSwapchainKHR swapchain,
+      VkAllocationCallbacks const* callbacks,
+      std::vector<VkImage> images,
+      VkFormat format,
+      VkExtent2D extent,
+      VkPresentModeKHR presentMode)
+      : ParentedUniqueHandle{device, swapchain, callbacks},
         images_{std::move(images)},
         format_{format},
-        extent_{extent} {}
+        extent_{extent},
+        presentMode_{presentMode} {}
 
   std::vector<VkImage> images_;
   VkFormat format_;
   VkExtent2D extent_;
+  VkPresentModeKHR presentMode_;
 };
 
 struct ImageView : raii::ParentedUniqueHandle<VkImageView, vkDestroyImageView, VkDevice> {
-  ImageView(VkDevice device, VkImage image, VkFormat format)
+  ImageView(VkDevice device, VkImage image, VkFormat format, VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT)
       : ParentedUniqueHandle{[&] {
           VkImageViewCreateInfo createInfo{
               .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
@@ -352,7 +920,7 @@ struct ImageView : raii::ParentedUniqueHandle<VkImageView, vkDestroyImageView, V
               .format = format,
               .subresourceRange =
                   {
-                      .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                      .aspectMask = aspect,
                       .baseMipLevel = 0,
                       .levelCount = 1,
                       .baseArrayLayer = 0,
@@ -361,25 +929,123 @@ struct ImageView : raii::ParentedUniqueHandle<VkImageView, vkDestroyImageView, V
           };
 
           VkImageView imageView;
-          if (vkCreateImageView(device, &createInfo, nullptr, &imageView) != VK_SUCCESS) {
+          auto const callbacks = HostAllocator::get().callbacks(VK_OBJECT_TYPE_IMAGE_VIEW);
+          if (vkCreateImageView(device, &createInfo, callbacks, &imageView) != VK_SUCCESS) {
             throw std::runtime_error{"failed to create image view"};
           }
-          return std::tuple{device, imageView, nullptr};
+          return std::tuple{device, imageView, callbacks};
         }()} {}
 };
 
+struct DeviceMemory : raii::ParentedUniqueHandle<VkDeviceMemory, vkFreeMemory, VkDevice> {
+  DeviceMemory(VkDevice device, VkDeviceSize size, uint32_t memoryTypeIndex)
+      : ParentedUniqueHandle{[&] {
+          VkMemoryAllocateInfo allocInfo{
+              .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+              .allocationSize = size,
+              .memoryTypeIndex = memoryTypeIndex,
+          };
+
+          VkDeviceMemory memory{};
+          auto const callbacks = HostAllocator::get().callbacks(VK_OBJECT_TYPE_DEVICE_MEMORY);
+          if (vkAllocateMemory(device, &allocInfo, callbacks, &memory) != VK_SUCCESS) {
+            throw std::runtime_error{"failed to allocate device memory"};
+          }
+          return std::tuple{device, memory, callbacks};
+        }()} {}
+
+  // Maps the whole allocation; it stays mapped until the memory is freed.
+  void* map() const {
+    void* data{};
+    if (vkMapMemory(parent(), *this, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS) {
+      throw std::runtime_error{"failed to map device memory"};
+    }
+    return data;
+  }
+};
+
+struct Buffer : raii::ParentedUniqueHandle<VkBuffer, vkDestroyBuffer, VkDevice> {
+  Buffer(VkDevice device, VkDeviceSize size, VkBufferUsageFlags usage)
+      : ParentedUniqueHandle{[&] {
+          VkBufferCreateInfo createInfo{
+              .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+              .size = size,
+              .usage = usage,
+              .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+          };
+
+          VkBuffer buffer{};
+          auto const callbacks = HostAllocator::get().callbacks(VK_OBJECT_TYPE_BUFFER);
+          if (vkCreateBuffer(device, &createInfo, callbacks, &buffer) != VK_SUCCESS) {
+            throw std::runtime_error{"failed to create buffer"};
+          }
+          return std::tuple{device, buffer, callbacks};
+        }()} {}
+
+  VkMemoryRequirements memoryRequirements() const {
+    return raii::Fetcher<VkMemoryRequirements, vkGetBufferMemoryRequirements>(parent(), static_cast<VkBuffer>(*this));
+  }
+
+  void bind(VkDeviceMemory memory, VkDeviceSize offset = 0) const {
+    if (vkBindBufferMemory(parent(), *this, memory, offset) != VK_SUCCESS) {
+      throw std::runtime_error{"failed to bind buffer memory"};
+    }
+  }
+};
+
+// A 2D image with one mip level and layer; memory is bound separately.
+struct Image : raii::ParentedUniqueHandle<VkImage, vkDestroyImage, VkDevice> {
+  Image(
+      VkDevice device,
+      VkFormat format,
+      VkExtent2D extent,
+      VkImageUsageFlags usage,
+      VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT)
+      : ParentedUniqueHandle{[&] {
+          VkImageCreateInfo createInfo{
+              .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+              .imageType = VK_IMAGE_TYPE_2D,
+              .format = format,
+              .extent = {extent.width, extent.height, 1},
+              .mipLevels = 1,
+              .arrayLayers = 1,
+              .samples = samples,
+              .tiling = VK_IMAGE_TILING_OPTIMAL,
+              .usage = usage,
+              .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+              .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+          };
+
+          VkImage image{};
+          auto const callbacks = HostAllocator::get().callbacks(VK_OBJECT_TYPE_IMAGE);
+          if (vkCreateImage(device, &createInfo, callbacks, &image) != VK_SUCCESS) {
+            throw std::runtime_error{"failed to create image"};
+          }
+          return std::tuple{device, image, callbacks};
+        }()} {}
+
+  VkMemoryRequirements memoryRequirements() const {
+    return raii::Fetcher<VkMemoryRequirements, vkGetImageMemoryRequirements>(parent(), static_cast<VkImage>(*this));
+  }
+
+  void bind(VkDeviceMemory memory, VkDeviceSize offset = 0) const {
+    if (vkBindImageMemory(parent(), *this, memory, offset) != VK_SUCCESS) {
+      throw std::runtime_error{"failed to bind image memory"};
+    }
+  }
+};
+
+// SPIR-V from a file is mapped rather than read, and handed to the driver straight out of the page cache.
 struct ShaderModule : raii::ParentedUniqueHandle<VkShaderModule, vkDestroyShaderModule, VkDevice> {
-  ShaderModule(VkDevice device, std::filesystem::path shaderPath)
-      : ShaderModule{device, std::span<uint8_t const>{[&] {
-                       std::ifstream in{shaderPath, std::ios::ate | std::ios::binary};
-                       in.exceptions(std::ios::failbit | std::ios::badbit);
-                       std::vector<uint8_t> code(in.tellg());
-                       in.seekg(0, std::ios::beg);
-                       in.read(reinterpret_cast<char*>(code.data()), code.size());
-                       return code;
-                     }()}} {}
-  ShaderModule(VkDevice device, std::span<uint8_t const> const& code)
+  ShaderModule(VkDevice device, std::filesystem::path const& shaderPath)
+      : ShaderModule{device, MappedFile{shaderPath}.bytes()} {}
+  ShaderModule(VkDevice device, std::span<uint32_t const> code) : ShaderModule{device, std::as_bytes(code)} {}
+  ShaderModule(VkDevice device, std::span<std::byte const> code)
       : ParentedUniqueHandle{[&] {
+          if (code.size() % sizeof(uint32_t) != 0 ||
+              reinterpret_cast<uintptr_t>(code.data()) % alignof(uint32_t) != 0) {
+            throw std::runtime_error{"SPIR-V must be whole, aligned 32-bit words"};
+          }
           VkShaderModuleCreateInfo createInfo{
               .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
               .codeSize = static_cast<uint32_t>(code.size()),
@@ -387,58 +1053,278 @@ struct ShaderModule : raii::ParentedUniqueHandle<VkShaderModule, vkDestroyShader
           };
 
           VkShaderModule shaderModule;
-          if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
+          auto const callbacks = HostAllocator::get().callbacks(VK_OBJECT_TYPE_SHADER_MODULE);
+          if (vkCreateShaderModule(device, &createInfo, callbacks, &shaderModule) != VK_SUCCESS) {
             throw std::runtime_error{"failed to create shader module"};
           }
-          return std::tuple{device, shaderModule, nullptr};
+          return std::tuple{device, shaderModule, callbacks};
+        }()} {}
+};
+
+// `bindingFlags`, if given, has an entry per binding (these need descriptor indexing).
+struct DescriptorSetLayout : raii::ParentedUniqueHandle<VkDescriptorSetLayout, vkDestroyDescriptorSetLayout, VkDevice> {
+  DescriptorSetLayout(
+      VkDevice device,
+      std::span<VkDescriptorSetLayoutBinding const> bindings,
+      std::span<VkDescriptorBindingFlags const> bindingFlags = {},
+      VkDescriptorSetLayoutCreateFlags flags = 0)
+      : ParentedUniqueHandle{[&] {
+          VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsCreateInfo{
+              .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+              .bindingCount = static_cast<uint32_t>(bindingFlags.size()),
+              .pBindingFlags = bindingFlags.data(),
+          };
+          VkDescriptorSetLayoutCreateInfo createInfo{
+              .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+              .pNext = bindingFlags.empty() ? nullptr : &bindingFlagsCreateInfo,
+              .flags = flags,
+              .bindingCount = static_cast<uint32_t>(bindings.size()),
+              .pBindings = bindings.data(),
+          };
+
+          VkDescriptorSetLayout layout{};
+          auto const callbacks = HostAllocator::get().callbacks(VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT);
+          if (vkCreateDescriptorSetLayout(device, &createInfo, callbacks, &layout) != VK_SUCCESS) {
+            throw std::runtime_error{"failed to create descriptor set layout"};
+          }
+          return std::tuple{device, layout, callbacks};
+        }()} {}
+};
+
+// Sets allocated from the pool are freed along with it.
+struct DescriptorPool : raii::ParentedUniqueHandle<VkDescriptorPool, vkDestroyDescriptorPool, VkDevice> {
+  DescriptorPool(
+      VkDevice device,
+      uint32_t maxSets,
+      std::span<VkDescriptorPoolSize const> sizes,
+      VkDescriptorPoolCreateFlags flags = 0)
+      : ParentedUniqueHandle{[&] {
+          VkDescriptorPoolCreateInfo createInfo{
+              .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+              .flags = flags,
+              .maxSets = maxSets,
+              .poolSizeCount = static_cast<uint32_t>(sizes.size()),
+              .pPoolSizes = sizes.data(),
+          };
+
+          VkDescriptorPool pool{};
+          auto const callbacks = HostAllocator::get().callbacks(VK_OBJECT_TYPE_DESCRIPTOR_POOL);
+          if (vkCreateDescriptorPool(device, &createInfo, callbacks, &pool) != VK_SUCCESS) {
+            throw std::runtime_error{"failed to create descriptor pool"};
+          }
+          return std::tuple{device, pool, callbacks};
+        }()} {}
+
+  VkDescriptorSet allocate(VkDescriptorSetLayout layout) const {
+    VkDescriptorSetAllocateInfo allocInfo{
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = *this,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &layout,
+    };
+
+    VkDescriptorSet set{};
+    if (vkAllocateDescriptorSets(parent(), &allocInfo, &set) != VK_SUCCESS) {
+      throw std::runtime_error{"failed to allocate descriptor set"};
+    }
+    return set;
+  }
+};
+
+// Points consecutive bindings of `set`, starting at `firstBinding`, at the start of buffers. `range` is how much of
+// each a shader sees; dynamic descriptors need it to be the size of one element rather than the whole buffer.
+inline void writeBufferDescriptors(
+    VkDevice device,
+    VkDescriptorSet set,
+    VkDescriptorType type,
+    std::span<VkBuffer const> buffers,
+    uint32_t firstBinding = 0,
+    VkDeviceSize range = VK_WHOLE_SIZE) {
+  std::vector<VkDescriptorBufferInfo> infos;
+  std::vector<VkWriteDescriptorSet> writes;
+  infos.reserve(buffers.size());
+  for (size_t i{}; i < buffers.size(); i++) {
+    infos.push_back(VkDescriptorBufferInfo{.buffer = buffers[i], .offset = 0, .range = range});
+    writes.push_back(VkWriteDescriptorSet{
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = set,
+        .dstBinding = firstBinding + static_cast<uint32_t>(i),
+        .descriptorCount = 1,
+        .descriptorType = type,
+        .pBufferInfo = &infos.back(),
+    });
+  }
+  vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+// Points element `arrayElement` of `binding` at a sampled image, in SHADER_READ_ONLY_OPTIMAL.
+inline void writeImageDescriptor(
+    VkDevice device,
+    VkDescriptorSet set,
+    uint32_t binding,
+    uint32_t arrayElement,
+    VkSampler sampler,
+    VkImageView imageView) {
+  VkDescriptorImageInfo info{
+      .sampler = sampler,
+      .imageView = imageView,
+      .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+  };
+  VkWriteDescriptorSet write{
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = set,
+      .dstBinding = binding,
+      .dstArrayElement = arrayElement,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .pImageInfo = &info,
+  };
+  vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+}
+
+// Bilinear, repeating, no mips.
+struct Sampler : raii::ParentedUniqueHandle<VkSampler, vkDestroySampler, VkDevice> {
+  explicit Sampler(VkDevice device)
+      : ParentedUniqueHandle{[&] {
+          VkSamplerCreateInfo createInfo{
+              .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+              .magFilter = VK_FILTER_LINEAR,
+              .minFilter = VK_FILTER_LINEAR,
+              .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+              .addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+              .addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+              .addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+              .maxLod = 0,
+          };
+
+          VkSampler sampler{};
+          auto const callbacks = HostAllocator::get().callbacks(VK_OBJECT_TYPE_SAMPLER);
+          if (vkCreateSampler(device, &createInfo, callbacks, &sampler) != VK_SUCCESS) {
+            throw std::runtime_error{"failed to create sampler"};
+          }
+          return std::tuple{device, sampler, callbacks};
         }()} {}
 };
 
 struct PipelineLayout : raii::ParentedUniqueHandle<VkPipelineLayout, vkDestroyPipelineLayout, VkDevice> {
-  explicit PipelineLayout(VkDevice device)
+  explicit PipelineLayout(
+      VkDevice device,
+      std::span<VkDescriptorSetLayout const> setLayouts = {},
+      std::span<VkPushConstantRange const> pushConstantRanges = {})
       : ParentedUniqueHandle{[&] {
           VkPipelineLayoutCreateInfo createInfo{
               .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+              .setLayoutCount = static_cast<uint32_t>(setLayouts.size()),
+              .pSetLayouts = setLayouts.data(),
+              .pushConstantRangeCount = static_cast<uint32_t>(pushConstantRanges.size()),
+              .pPushConstantRanges = pushConstantRanges.data(),
           };
 
           VkPipelineLayout layout{};
-          if (vkCreatePipelineLayout(device, &createInfo, nullptr, &layout) != VK_SUCCESS) {
+          auto const callbacks = HostAllocator::get().callbacks(VK_OBJECT_TYPE_PIPELINE_LAYOUT);
+          if (vkCreatePipelineLayout(device, &createInfo, callbacks, &layout) != VK_SUCCESS) {
             throw std::runtime_error{"failed to create pipeline layout"};
           }
-          return std::tuple{device, layout, nullptr};
+          return std::tuple{device, layout, callbacks};
         }()} {}
 };
 
+// One subpass drawing into a single colour attachment. With more than one sample that attachment is a multisampled
+// image that is cleared, resolved into attachment 1 (the image that is kept) and then discarded, so its contents never
+// need to leave tile memory. A `depthFormat` adds a depth attachment after those, likewise cleared and discarded. The
+// framebuffer is {[multisampled view,] view[, depth view]}.
 struct RenderPass : raii::ParentedUniqueHandle<VkRenderPass, vkDestroyRenderPass, VkDevice> {
-  explicit RenderPass(VkDevice device, VkFormat swapchainFormat)
+  explicit RenderPass(
+      VkDevice device,
+      VkFormat swapchainFormat,
+      VkImageLayout finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+      VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT,
+      VkFormat depthFormat = VK_FORMAT_UNDEFINED)
       : ParentedUniqueHandle{[&] {
-          std::array attachments{VkAttachmentDescription{
+          auto const multisampled = samples != VK_SAMPLE_COUNT_1_BIT;
+          auto const depth = depthFormat != VK_FORMAT_UNDEFINED;
+          std::vector attachments{VkAttachmentDescription{
               .format = swapchainFormat,
-              .samples = VK_SAMPLE_COUNT_1_BIT,
+              .samples = samples,
               .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-              .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+              .storeOp = multisampled ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE,
               .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
               .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
               .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-              .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+              .finalLayout = multisampled ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : finalLayout,
           }};
+          if (multisampled) {
+            attachments.push_back(VkAttachmentDescription{
+                .format = swapchainFormat,
+                .samples = VK_SAMPLE_COUNT_1_BIT,
+                .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+                .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+                .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+                .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+                .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+                .finalLayout = finalLayout,
+            });
+          }
+          VkAttachmentReference depthRef{
+              .attachment = static_cast<uint32_t>(attachments.size()),
+              .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+          };
+          if (depth) {
+            attachments.push_back(VkAttachmentDescription{
+                .format = depthFormat,
+                .samples = samples,
+                .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+                .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+                .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+                .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+                .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+                .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            });
+          }
           std::array attachRefs{VkAttachmentReference{
               .attachment = 0,
               .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
           }};
+          std::array resolveRefs{VkAttachmentReference{
+              .attachment = 1,
+              .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+          }};
           std::array subpasses{VkSubpassDescription{
               .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
               .colorAttachmentCount = static_cast<uint32_t>(attachRefs.size()),
               .pColorAttachments = attachRefs.data(),
+              .pResolveAttachments = multisampled ? resolveRefs.data() : nullptr,
+              .pDepthStencilAttachment = depth ? &depthRef : nullptr,
           }};
-          std::array subpassDeps{VkSubpassDependency{
-              .srcSubpass = VK_SUBPASS_EXTERNAL,
-              .dstSubpass = 0,
-              .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-              .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-              .srcAccessMask = 0,
-              .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-          }};
+          // the multisampled and depth images are shared by every frame in flight, so unlike a swapchain image (which
+          // the acquire semaphore already orders) the previous frame's writes to them have to be waited on
+          VkPipelineStageFlags const depthStages{
+              VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT};
+          std::array subpassDeps{
+              VkSubpassDependency{
+                  .srcSubpass = VK_SUBPASS_EXTERNAL,
+                  .dstSubpass = 0,
+                  .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | (depth ? depthStages : 0),
+                  .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | (depth ? depthStages : 0),
+                  .srcAccessMask =
+                      (multisampled ? VkAccessFlags{VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT} : VkAccessFlags{}) |
+                      (depth ? VkAccessFlags{VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT} : VkAccessFlags{}),
+                  .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                                   (depth ? VkAccessFlags{VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                                                          VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT}
+                                          : VkAccessFlags{}),
+              },
+              // the implicit dependency out of the pass only reaches BOTTOM_OF_PIPE, which would leave a barrier
+              // recorded after it (an ownership transfer of the final image) unordered with the final transition
+              VkSubpassDependency{
+                  .srcSubpass = 0,
+                  .dstSubpass = VK_SUBPASS_EXTERNAL,
+                  .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                  .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                  .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                  .dstAccessMask = 0,
+              },
+          };
 
           VkRenderPassCreateInfo createInfo{
               .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
@@ -451,45 +1337,323 @@ struct RenderPass : raii::ParentedUniqueHandle<VkRenderPass, vkDestroyRenderPass
           };
 
           VkRenderPass renderPass{};
-          if (vkCreateRenderPass(device, &createInfo, nullptr, &renderPass) != VK_SUCCESS) {
+          auto const callbacks = HostAllocator::get().callbacks(VK_OBJECT_TYPE_RENDER_PASS);
+          if (vkCreateRenderPass(device, &createInfo, callbacks, &renderPass) != VK_SUCCESS) {
             throw std::runtime_error{"failed to create render pass"};
           }
-          return std::tuple{device, renderPass, nullptr};
+          return std::tuple{device, renderPass, callbacks};
         }()} {}
 };
 
+// Pipeline cache persisted to disk between runs. The blob is stored in `directory` under a name derived from the
+// device's pipelineCacheUUID and driver version, and its header is validated before being handed to the driver so a
+// cache from a different GPU or driver is discarded rather than trusted.
+struct PipelineCache : raii::ParentedUniqueHandle<VkPipelineCache, vkDestroyPipelineCache, VkDevice> {
+  PipelineCache(Device const& device, std::filesystem::path const& directory)
+      : PipelineCache{[&] {
+          auto const& props = device.physicalDeviceInfo().properties;
+          auto path = directory / [&] {
+            std::ostringstream name;
+            name << std::hex << std::setfill('0');
+            for (auto b : props.pipelineCacheUUID) {
+              name << std::setw(2) << static_cast<unsigned>(b);
+            }
+            name << '-' << std::setw(8) << props.driverVersion << ".bin";
+            return name.str();
+          }();
+
+          std::vector<uint8_t> initialData;
+          if (std::filesystem::exists(path)) {
+            initialData = readFile(path);
+            if (!isCompatible(initialData, props)) {
+              initialData.clear();
+            }
+          }
+
+          VkPipelineCacheCreateInfo createInfo{
+              .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+              .initialDataSize = initialData.size(),
+              .pInitialData = initialData.data(),
+          };
+
+          VkPipelineCache cache{};
+          auto const callbacks = HostAllocator::get().callbacks(VK_OBJECT_TYPE_PIPELINE_CACHE);
+          if (vkCreatePipelineCache(device, &createInfo, callbacks, &cache) != VK_SUCCESS) {
+            throw std::runtime_error{"failed to create pipeline cache"};
+          }
+          return PipelineCache{device, cache, callbacks, std::move(path)};
+        }()} {}
+
+  void save() const {
+    size_t size{};
+    vkGetPipelineCacheData(parent(), *this, &size, nullptr);
+    std::vector<uint8_t> data(size);
+    if (vkGetPipelineCacheData(parent(), *this, &size, data.data()) != VK_SUCCESS) {
+      throw std::runtime_error{"failed to get pipeline cache data"};
+    }
+
+    // write-then-rename so a crash mid-write never leaves a truncated blob behind
+    std::filesystem::create_directories(path_.parent_path());
+    auto tmpPath = std::filesystem::path{path_}.concat(".tmp");
+    {
+      std::ofstream out{tmpPath, std::ios::binary | std::ios::trunc};
+      out.exceptions(std::ios::failbit | std::ios::badbit);
+      out.write(reinterpret_cast<char const*>(data.data()), size);
+    }
+    std::filesystem::rename(tmpPath, path_);
+  }
+
+ private:
+  PipelineCache(
+      VkDevice device, VkPipelineCache cache, VkAllocationCallbacks const* callbacks, std::filesystem::path path)
+      : ParentedUniqueHandle{device, cache, callbacks}, path_{std::move(path)} {}
+
+  static bool isCompatible(std::span<uint8_t const> data, VkPhysicalDeviceProperties const& props) {
+    VkPipelineCacheHeaderVersionOne header;
+    if (data.size() < sizeof(header)) {
+      return false;
+    }
+    std::memcpy(&header, data.data(), sizeof(header));
+    return header.headerSize >= sizeof(header) && header.headerSize <= data.size() &&
+           header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE && header.vendorID == props.vendorID &&
+           header.deviceID == props.deviceID &&
+           std::memcmp(header.pipelineCacheUUID, props.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+  }
+
+  std::filesystem::path path_;
+};
+
+// Layout of the vertex buffers a pipeline reads; empty for shaders that generate their own vertices.
+struct VertexInput {
+  std::vector<VkVertexInputBindingDescription> bindings;
+  std::vector<VkVertexInputAttributeDescription> attributes;
+
+  bool operator==(VertexInput const& other) const {
+    // both descriptions are all 32-bit fields, so there is no padding to trip memcmp
+    auto same = [](auto const& a, auto const& b) {
+      return a.size() == b.size() && (a.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(a[0])) == 0);
+    };
+    return same(bindings, other.bindings) && same(attributes, other.attributes);
+  }
+};
+
+// What a graphics pipeline renders into: subpass 0 of `renderPass`, or with dynamic rendering (no render pass) a single
+// colour attachment of `colorFormat`, rasterized at `samples`. Depth testing is enabled when there is a `depthFormat`;
+// for a render pass that must match its depth attachment.
+struct RenderTarget {
+  static RenderTarget subpass(
+      VkRenderPass renderPass,
+      VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT,
+      VkFormat depthFormat = VK_FORMAT_UNDEFINED) {
+    return RenderTarget{.renderPass = renderPass, .samples = samples, .depthFormat = depthFormat};
+  }
+
+  static RenderTarget dynamic(
+      VkFormat colorFormat,
+      VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT,
+      VkFormat depthFormat = VK_FORMAT_UNDEFINED) {
+    return RenderTarget{.colorFormat = colorFormat, .samples = samples, .depthFormat = depthFormat};
+  }
+
+  VkRenderPass renderPass{};
+  VkFormat colorFormat{VK_FORMAT_UNDEFINED};
+  VkSampleCountFlagBits samples{VK_SAMPLE_COUNT_1_BIT};
+  VkFormat depthFormat{VK_FORMAT_UNDEFINED};
+
+  bool operator==(RenderTarget const&) const = default;
+};
+
+// How a graphics pipeline uses the depth attachment, if its target has one. The defaults are an ordinary opaque pass;
+// after a depth prepass, the colour pass only tests for EQUAL and writes nothing, so each pixel is shaded once.
+struct DepthTest {
+  bool write{true};
+  VkCompareOp compareOp{VK_COMPARE_OP_LESS};
+
+  bool operator==(DepthTest const&) const = default;
+};
+
+// Specialization constants for a shader stage, as (constant ID, value) pairs. Every scalar constant type a shader can
+// declare (bool, int, uint, float) is 32 bits, so one word per constant covers them all.
+using SpecializationConstants = std::vector<std::pair<uint32_t, uint32_t>>;
+
+// The VkSpecializationInfo for some SpecializationConstants, kept alive as long as the create info pointing at it.
+struct Specialization {
+  explicit Specialization(SpecializationConstants const& constants) {
+    for (auto const& [id, value] : constants) {
+      entries_.push_back(VkSpecializationMapEntry{
+          .constantID = id,
+          .offset = static_cast<uint32_t>(data_.size() * sizeof(uint32_t)),
+          .size = sizeof(uint32_t),
+      });
+      data_.push_back(value);
+    }
+    info_ = VkSpecializationInfo{
+        .mapEntryCount = static_cast<uint32_t>(entries_.size()),
+        .pMapEntries = entries_.data(),
+        .dataSize = data_.size() * sizeof(uint32_t),
+        .pData = data_.data(),
+    };
+  }
+
+  Specialization(Specialization const&) = delete;
+  Specialization& operator=(Specialization const&) = delete;
+
+  // null when there are no constants
+  VkSpecializationInfo const* info() const {
+    return entries_.empty() ? nullptr : &info_;
+  }
+
+ private:
+  std::vector<VkSpecializationMapEntry> entries_;
+  std::vector<uint32_t> data_;
+  VkSpecializationInfo info_{};
+};
+
+// A shader module, the entry point to use and the constants to specialize it with. The module is shared rather than a
+// bare handle so that a stage compares equal only to stages of the very same module: a destroyed module's handle
+// value can be reused by a new one, but not while a stage still holds the old module alive.
+struct ShaderStage {
+  std::shared_ptr<ShaderModule const> module;
+  std::string entryPoint{"main"};
+  SpecializationConstants constants;
+
+  bool operator==(ShaderStage const&) const = default;
+};
+
+// Everything that picks out a graphics pipeline, as a value that can be compared and hashed, so that identical descs
+// can share one VkPipeline (see PipelineLibrary). Without a `fragment` stage the pipeline only writes depth, e.g. for a
+// depth prepass. `alphaBlend` blends the colour output over the target by its alpha.
+struct PipelineDesc {
+  ShaderStage vertex;
+  std::optional<ShaderStage> fragment;
+  VkPipelineLayout layout{};
+  RenderTarget target;
+  VertexInput vertexInput;
+  DepthTest depthTest;
+  VkPrimitiveTopology topology{VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST};
+  VkCullModeFlags cullMode{VK_CULL_MODE_BACK_BIT};
+  VkFrontFace frontFace{VK_FRONT_FACE_CLOCKWISE};
+  bool alphaBlend{};
+
+  bool operator==(PipelineDesc const&) const = default;
+
+  size_t hash() const {
+    // 64-bit FNV-1a over each field in turn, even where size_t is 32 bits; fields are hashed one by one so that struct
+    // padding never gets in
+    uint64_t h{14695981039346656037ull};
+    auto add = [&](auto const& value) {
+      auto const* bytes = reinterpret_cast<unsigned char const*>(&value);
+      for (size_t i{}; i < sizeof(value); i++) {
+        h = (h ^ bytes[i]) * 1099511628211ull;
+      }
+    };
+    auto addStage = [&](ShaderStage const& stage) {
+      add(stage.module.get());
+      for (auto c : stage.entryPoint) {
+        add(c);
+      }
+      for (auto const& constant : stage.constants) {
+        add(constant.first);
+        add(constant.second);
+      }
+    };
+    addStage(vertex);
+    add(fragment.has_value());
+    if (fragment) {
+      addStage(*fragment);
+    }
+    add(layout);
+    add(target.renderPass);
+    add(target.colorFormat);
+    add(target.samples);
+    add(target.depthFormat);
+    for (auto const& binding : vertexInput.bindings) {
+      add(binding);
+    }
+    for (auto const& attribute : vertexInput.attributes) {
+      add(attribute);
+    }
+    add(depthTest.write);
+    add(depthTest.compareOp);
+    add(topology);
+    add(cullMode);
+    add(frontFace);
+    add(alphaBlend);
+    return static_cast<size_t>(h);
+  }
+};
+
 struct Pipeline : raii::ParentedUniqueHandle<VkPipeline, vkDestroyPipeline, VkDevice> {
+  // Compute pipeline.
   Pipeline(
       VkDevice device,
-      ShaderModule const& vertexShader,
-      ShaderModule const& fragmentShader,
+      VkPipelineCache cache,
+      ShaderModule const& computeShader,
       VkPipelineLayout layout,
-      VkRenderPass renderPass)
+      SpecializationConstants const& constants = {})
+      : ParentedUniqueHandle{[&] {
+          Specialization specialization{constants};
+          VkComputePipelineCreateInfo createInfo{
+              .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+              .stage =
+                  {
+                      .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                      .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+                      .module = computeShader,
+                      .pName = "main",
+                      .pSpecializationInfo = specialization.info(),
+                  },
+              .layout = layout,
+          };
+
+          VkPipeline pipeline;
+          auto const callbacks = HostAllocator::get().callbacks(VK_OBJECT_TYPE_PIPELINE);
+          if (vkCreateComputePipelines(device, cache, 1, &createInfo, callbacks, &pipeline) != VK_SUCCESS) {
+            throw std::runtime_error{"failed to create compute pipeline"};
+          }
+          return std::tuple{device, pipeline, callbacks};
+        }()} {}
+
+  // Graphics pipeline.
+  Pipeline(VkDevice device, VkPipelineCache cache, PipelineDesc const& desc)
       : ParentedUniqueHandle{[&] {
+          auto const& vertex = desc.vertex;
+          auto const& fragment = desc.fragment;
+          auto const& target = desc.target;
+          auto const& vertexInput = desc.vertexInput;
+          auto const& depthTest = desc.depthTest;
+          Specialization vertexSpecialization{vertex.constants};
           std::vector<VkPipelineShaderStageCreateInfo> stages{
               VkPipelineShaderStageCreateInfo{
                   .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
                   .stage = VK_SHADER_STAGE_VERTEX_BIT,
-                  .module = vertexShader,
-                  .pName = "main",
-              },
-              VkPipelineShaderStageCreateInfo{
-                  .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-                  .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-                  .module = fragmentShader,
-                  .pName = "main",
+                  .module = *vertex.module,
+                  .pName = vertex.entryPoint.c_str(),
+                  .pSpecializationInfo = vertexSpecialization.info(),
               },
           };
+          std::optional<Specialization> fragmentSpecialization;
+          if (fragment) {
+            stages.push_back(VkPipelineShaderStageCreateInfo{
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+                .module = *fragment->module,
+                .pName = fragment->entryPoint.c_str(),
+                .pSpecializationInfo = fragmentSpecialization.emplace(fragment->constants).info(),
+            });
+          }
 
           VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo{
               .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-              .vertexBindingDescriptionCount = 0,
-              .vertexAttributeDescriptionCount = 0,
+              .vertexBindingDescriptionCount = static_cast<uint32_t>(vertexInput.bindings.size()),
+              .pVertexBindingDescriptions = vertexInput.bindings.data(),
+              .vertexAttributeDescriptionCount = static_cast<uint32_t>(vertexInput.attributes.size()),
+              .pVertexAttributeDescriptions = vertexInput.attributes.data(),
           };
 
           VkPipelineInputAssemblyStateCreateInfo inputAssembyStateCreateInfo{
               .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-              .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+              .topology = desc.topology,
               .primitiveRestartEnable = false,
           };
 
@@ -509,19 +1673,35 @@ struct Pipeline : raii::ParentedUniqueHandle<VkPipeline, vkDestroyPipeline, VkDe
           VkPipelineRasterizationStateCreateInfo rasterizationCreateInfo{
               .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
               .polygonMode = VK_POLYGON_MODE_FILL,
-              .cullMode = VK_CULL_MODE_BACK_BIT,
-              .frontFace = VK_FRONT_FACE_CLOCKWISE,
+              .cullMode = desc.cullMode,
+              .frontFace = desc.frontFace,
               .lineWidth = 1.0f,
           };
 
           VkPipelineMultisampleStateCreateInfo multisampleCreateInfo{
               .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
-              .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+              .rasterizationSamples = target.samples,
+          };
+
+          VkPipelineDepthStencilStateCreateInfo depthStencilCreateInfo{
+              .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+              .depthTestEnable = true,
+              .depthWriteEnable = depthTest.write,
+              .depthCompareOp = depthTest.compareOp,
           };
 
+          // a depth-only pipeline has no fragment outputs, and colour it did write would be undefined
+          VkColorComponentFlags const allComponents{VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                                                    VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT};
           std::array colorBlendAttachments{VkPipelineColorBlendAttachmentState{
-              .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT |
-                                VK_COLOR_COMPONENT_A_BIT,
+              .blendEnable = desc.alphaBlend,
+              .srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
+              .dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+              .colorBlendOp = VK_BLEND_OP_ADD,
+              .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+              .dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+              .alphaBlendOp = VK_BLEND_OP_ADD,
+              .colorWriteMask = fragment ? allComponents : VkColorComponentFlags{},
           }};
           VkPipelineColorBlendStateCreateInfo colorBlendStateCreateInfo{
               .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
@@ -529,9 +1709,17 @@ struct Pipeline : raii::ParentedUniqueHandle<VkPipeline, vkDestroyPipeline, VkDe
               .pAttachments = colorBlendAttachments.data(),
           };
 
+          VkPipelineRenderingCreateInfoKHR renderingCreateInfo{
+              .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR,
+              .colorAttachmentCount = 1,
+              .pColorAttachmentFormats = &target.colorFormat,
+              .depthAttachmentFormat = target.depthFormat,
+          };
+
           std::vector<VkGraphicsPipelineCreateInfo> createInfos;
           createInfos.emplace_back(VkGraphicsPipelineCreateInfo{
               .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+              .pNext = target.renderPass ? nullptr : &renderingCreateInfo,
               .stageCount = static_cast<uint32_t>(stages.size()),
               .pStages = stages.data(),
               .pVertexInputState = &vertexInputCreateInfo,
@@ -539,19 +1727,21 @@ struct Pipeline : raii::ParentedUniqueHandle<VkPipeline, vkDestroyPipeline, VkDe
               .pViewportState = &viewportStateCreateInfo,
               .pRasterizationState = &rasterizationCreateInfo,
               .pMultisampleState = &multisampleCreateInfo,
+              .pDepthStencilState = target.depthFormat != VK_FORMAT_UNDEFINED ? &depthStencilCreateInfo : nullptr,
               .pColorBlendState = &colorBlendStateCreateInfo,
               .pDynamicState = &dynamicStateCreateInfo,
-              .layout = layout,
-              .renderPass = renderPass,
+              .layout = desc.layout,
+              .renderPass = target.renderPass,
           });
 
           VkPipeline pipeline;
+          auto const callbacks = HostAllocator::get().callbacks(VK_OBJECT_TYPE_PIPELINE);
           if (vkCreateGraphicsPipelines(
-                  device, {}, static_cast<uint32_t>(createInfos.size()), createInfos.data(), nullptr, &pipeline) !=
+                  device, cache, static_cast<uint32_t>(createInfos.size()), createInfos.data(), callbacks, &pipeline) !=
               VK_SUCCESS) {
             throw std::runtime_error{"failed to create graphics pipelines"};
           }
-          return std::tuple{device, pipeline, nullptr};
+          return std::tuple{device, pipeline, callbacks};
         }()} {}
 };
 
@@ -569,10 +1759,11 @@ struct Framebuffer : raii::ParentedUniqueHandle<VkFramebuffer, vkDestroyFramebuf
           };
 
           VkFramebuffer framebuffer{};
-          if (vkCreateFramebuffer(device, &createInfo, nullptr, &framebuffer) != VK_SUCCESS) {
+          auto const callbacks = HostAllocator::get().callbacks(VK_OBJECT_TYPE_FRAMEBUFFER);
+          if (vkCreateFramebuffer(device, &createInfo, callbacks, &framebuffer) != VK_SUCCESS) {
             throw std::runtime_error{"failed to create framebuffer"};
           }
-          return std::tuple{device, framebuffer, nullptr};
+          return std::tuple{device, framebuffer, callbacks};
         }()} {}
 };
 
@@ -586,17 +1777,19 @@ struct CommandPool : raii::ParentedUniqueHandle<VkCommandPool, vkDestroyCommandP
           };
 
           VkCommandPool commandPool{};
-          if (vkCreateCommandPool(device, &createInfo, nullptr, &commandPool) != VK_SUCCESS) {
+          auto const callbacks = HostAllocator::get().callbacks(VK_OBJECT_TYPE_COMMAND_POOL);
+          if (vkCreateCommandPool(device, &createInfo, callbacks, &commandPool) != VK_SUCCESS) {
             throw std::runtime_error{"failed to create command pool"};
           }
-          return std::tuple{device, commandPool, nullptr};
+          return std::tuple{device, commandPool, callbacks};
         }()} {}
 
-  std::vector<VkCommandBuffer> allocateBuffers(uint32_t count) {
+  std::vector<VkCommandBuffer> allocateBuffers(
+      uint32_t count, VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY) {
     VkCommandBufferAllocateInfo info{
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
         .commandPool = *this,
-        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .level = level,
         .commandBufferCount = count,
     };
 
@@ -606,6 +1799,13 @@ struct CommandPool : raii::ParentedUniqueHandle<VkCommandPool, vkDestroyCommandP
     }
     return buffers;
   }
+
+  // Resets every buffer allocated from the pool at once, which is cheaper than resetting them individually.
+  void reset() const {
+    if (vkResetCommandPool(parent(), *this, 0) != VK_SUCCESS) {
+      throw std::runtime_error{"failed to reset command pool"};
+    }
+  }
 };
 
 struct Semaphore : raii::ParentedUniqueHandle<VkSemaphore, vkDestroySemaphore, VkDevice> {
@@ -615,11 +1815,88 @@ struct Semaphore : raii::ParentedUniqueHandle<VkSemaphore, vkDestroySemaphore, V
               .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
           };
           VkSemaphore semaphore{};
-          if (vkCreateSemaphore(device, &createInfo, nullptr, &semaphore) != VK_SUCCESS) {
+          auto const callbacks = HostAllocator::get().callbacks(VK_OBJECT_TYPE_SEMAPHORE);
+          if (vkCreateSemaphore(device, &createInfo, callbacks, &semaphore) != VK_SUCCESS) {
             throw std::runtime_error{"failed to create semaphore"};
           }
-          return std::tuple{device, semaphore, nullptr};
+          return std::tuple{device, semaphore, callbacks};
+        }()} {}
+};
+
+struct QueryPool : raii::ParentedUniqueHandle<VkQueryPool, vkDestroyQueryPool, VkDevice> {
+  QueryPool(VkDevice device, VkQueryType type, uint32_t count)
+      : ParentedUniqueHandle{[&] {
+          VkQueryPoolCreateInfo createInfo{
+              .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+              .queryType = type,
+              .queryCount = count,
+          };
+          VkQueryPool queryPool{};
+          auto const callbacks = HostAllocator::get().callbacks(VK_OBJECT_TYPE_QUERY_POOL);
+          if (vkCreateQueryPool(device, &createInfo, callbacks, &queryPool) != VK_SUCCESS) {
+            throw std::runtime_error{"failed to create query pool"};
+          }
+          return std::tuple{device, queryPool, callbacks};
+        }()} {}
+
+  // Copies out 64-bit results starting at `first` without waiting; returns false if any of them isn't available yet.
+  bool results(uint32_t first, std::span<uint64_t> out) const {
+    auto res = vkGetQueryPoolResults(
+        parent(),
+        *this,
+        first,
+        static_cast<uint32_t>(out.size()),
+        out.size_bytes(),
+        out.data(),
+        sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT);
+    if (res == VK_NOT_READY) {
+      return false;
+    } else if (res != VK_SUCCESS) {
+      throw std::runtime_error{"failed to get query pool results"};
+    }
+    return true;
+  }
+};
+
+// Requires Device::Features::timelineSemaphore.
+struct TimelineSemaphore : raii::ParentedUniqueHandle<VkSemaphore, vkDestroySemaphore, VkDevice> {
+  explicit TimelineSemaphore(VkDevice device, uint64_t initialValue = 0)
+      : ParentedUniqueHandle{[&] {
+          VkSemaphoreTypeCreateInfo typeCreateInfo{
+              .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+              .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+              .initialValue = initialValue,
+          };
+          VkSemaphoreCreateInfo createInfo{
+              .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+              .pNext = &typeCreateInfo,
+          };
+          VkSemaphore semaphore{};
+          auto const callbacks = HostAllocator::get().callbacks(VK_OBJECT_TYPE_SEMAPHORE);
+          if (vkCreateSemaphore(device, &createInfo, callbacks, &semaphore) != VK_SUCCESS) {
+            throw std::runtime_error{"failed to create timeline semaphore"};
+          }
+          return std::tuple{device, semaphore, callbacks};
         }()} {}
+
+  uint64_t value() const {
+    uint64_t value{};
+    if (vkGetSemaphoreCounterValue(parent(), *this, &value) != VK_SUCCESS) {
+      throw std::runtime_error{"failed to get semaphore counter value"};
+    }
+    return value;
+  }
+
+  bool wait(uint64_t value, uint64_t timeout = std::numeric_limits<uint64_t>::max()) const {
+    VkSemaphoreWaitInfo waitInfo{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = ptr(),
+        .pValues = &value,
+    };
+    return vkWaitSemaphores(parent(), &waitInfo, timeout) == VK_SUCCESS;
+  }
 };
 
 struct Fence : raii::ParentedUniqueHandle<VkFence, vkDestroyFence, VkDevice> {
@@ -630,10 +1907,11 @@ struct Fence : raii::ParentedUniqueHandle<VkFence, vkDestroyFence, VkDevice> {
               .flags = flags,
           };
           VkFence fence{};
-          if (vkCreateFence(device, &createInfo, nullptr, &fence) != VK_SUCCESS) {
+          auto const callbacks = HostAllocator::get().callbacks(VK_OBJECT_TYPE_FENCE);
+          if (vkCreateFence(device, &createInfo, callbacks, &fence) != VK_SUCCESS) {
             throw std::runtime_error{"failed to create fence"};
           }
-          return std::tuple{device, fence, nullptr};
+          return std::tuple{device, fence, callbacks};
         }()} {}
 
   void wait(uint64_t timeout = std::numeric_limits<uint64_t>::max()) const {
@@ -645,36 +1923,156 @@ struct Fence : raii::ParentedUniqueHandle<VkFence, vkDestroyFence, VkDevice> {
     std::array fences{static_cast<VkFence>(*this)};
     vkResetFences(parent(), static_cast<uint32_t>(fences.size()), fences.data());
   }
+
+  bool signaled() const {
+    return vkGetFenceStatus(parent(), *this) == VK_SUCCESS;
+  }
 };
 
-inline auto presentQueue(Device const& device, VkSwapchainKHR swapchain, VkSemaphore renderFinished, uint32_t imgIdx) {
+inline void cmdMemoryBarrier(
+    VkCommandBuffer cmd,
+    VkPipelineStageFlags srcStage,
+    VkAccessFlags srcAccess,
+    VkPipelineStageFlags dstStage,
+    VkAccessFlags dstAccess) {
+  VkMemoryBarrier barrier{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = srcAccess,
+      .dstAccessMask = dstAccess,
+  };
+  vkCmdPipelineBarrier(cmd, srcStage, dstStage, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+// Transitions every mip and layer of an image (by default a colour one) from `oldLayout` to `newLayout`. Two different
+// queue families make it one half of an ownership transfer, to be recorded identically as the release on the source
+// family's queue and then the acquire on the destination's.
+inline void cmdImageBarrier(
+    VkCommandBuffer cmd,
+    VkImage image,
+    VkImageLayout oldLayout,
+    VkImageLayout newLayout,
+    VkPipelineStageFlags srcStage,
+    VkAccessFlags srcAccess,
+    VkPipelineStageFlags dstStage,
+    VkAccessFlags dstAccess,
+    VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT,
+    uint32_t srcQueueFamily = VK_QUEUE_FAMILY_IGNORED,
+    uint32_t dstQueueFamily = VK_QUEUE_FAMILY_IGNORED) {
+  VkImageMemoryBarrier barrier{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+      .srcAccessMask = srcAccess,
+      .dstAccessMask = dstAccess,
+      .oldLayout = oldLayout,
+      .newLayout = newLayout,
+      .srcQueueFamilyIndex = srcQueueFamily,
+      .dstQueueFamilyIndex = dstQueueFamily,
+      .image = image,
+      .subresourceRange =
+          {
+              .aspectMask = aspect,
+              .levelCount = VK_REMAINING_MIP_LEVELS,
+              .layerCount = VK_REMAINING_ARRAY_LAYERS,
+          },
+  };
+  vkCmdPipelineBarrier(cmd, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+// presentFence is only meaningful (and must only be non-null) when VK_EXT_swapchain_maintenance1 is enabled; it is
+// signaled once the presentation engine is done with the swapchain image and renderFinished. A non-zero presentId
+// (which needs Device::Features::presentWait) tags the present for waitForPresent().
+template <bool ErrorOnSuboptimal = true>
+inline auto presentQueue(
+    Device const& device,
+    VkSwapchainKHR swapchain,
+    VkSemaphore renderFinished,
+    uint32_t imgIdx,
+    VkFence presentFence = {},
+    uint64_t presentId = 0) {
+  VkPresentIdKHR presentIdInfo{
+      .sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR,
+      .swapchainCount = 1,
+      .pPresentIds = &presentId,
+  };
+  VkSwapchainPresentFenceInfoEXT presentFenceInfo{
+      .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_PRESENT_FENCE_INFO_EXT,
+      .swapchainCount = 1,
+      .pFences = &presentFence,
+  };
+  void const* presentChain{};
+  if (presentId) {
+    presentChain = &presentIdInfo;
+  }
+  if (presentFence) {
+    presentFenceInfo.pNext = std::exchange(presentChain, &presentFenceInfo);
+  }
   VkPresentInfoKHR presentInfo{
       .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+      .pNext = presentChain,
       .waitSemaphoreCount = 1,
       .pWaitSemaphores = &renderFinished,
       .swapchainCount = 1,
       .pSwapchains = &swapchain,
       .pImageIndices = &imgIdx,
   };
-  vkQueuePresentKHR(device.presentQueue().queue, &presentInfo);
+  auto res = vkQueuePresentKHR(device.presentQueue().queue, &presentInfo);
+  if (res == VK_ERROR_OUT_OF_DATE_KHR || (res == VK_SUBOPTIMAL_KHR && ErrorOnSuboptimal)) {
+    throw OutOfDateError{};
+  } else if (res != VK_SUCCESS && res != VK_SUBOPTIMAL_KHR) {
+    throw std::runtime_error{"failed to present"};
+  }
+}
+
+// Blocks until the present tagged `presentId` has reached the display, or `timeout` ns have passed. Returns false if
+// it timed out or the swapchain has gone out of date, which the next acquire will report anyway.
+inline bool waitForPresent(Device const& device, VkSwapchainKHR swapchain, uint64_t presentId, uint64_t timeout) {
+  switch (device.dispatch().waitForPresent(device, swapchain, presentId, timeout)) {
+    case VK_SUCCESS:
+    case VK_SUBOPTIMAL_KHR:
+      return true;
+    case VK_TIMEOUT:
+    case VK_ERROR_OUT_OF_DATE_KHR:
+      return false;
+    default:
+      throw std::runtime_error{"failed to wait for present"};
+  }
 }
 
+// When `timeline` is given it is signaled to `timelineValue` alongside renderFinished; cmdBufferReady may then be null.
+// imageAvailable and renderFinished may be null when there is no swapchain to synchronise with.
 inline auto queueSubmit(
     Device const& device,
     VkCommandBuffer cmdBuffer,
     VkSemaphore imageAvailable,
     VkSemaphore renderFinished,
-    VkFence cmdBufferReady) {
+    VkFence cmdBufferReady,
+    VkSemaphore timeline = {},
+    uint64_t timelineValue = 0) {
   std::array waitStages{VkPipelineStageFlags{VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT}};
+  std::array<VkSemaphore, 2> signalSemaphores{};
+  std::array<uint64_t, 2> signalValues{};  // binary semaphores' values are ignored
+  uint32_t signalCount{};
+  if (renderFinished) {
+    signalSemaphores[signalCount++] = renderFinished;
+  }
+  if (timeline) {
+    signalValues[signalCount] = timelineValue;
+    signalSemaphores[signalCount++] = timeline;
+  }
+  VkTimelineSemaphoreSubmitInfo timelineInfo{
+      .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+      .signalSemaphoreValueCount = signalCount,
+      .pSignalSemaphoreValues = signalValues.data(),
+  };
   std::array submitInfos{VkSubmitInfo{
       .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-      .waitSemaphoreCount = 1,
+      .pNext = timeline ? &timelineInfo : nullptr,
+      .waitSemaphoreCount = imageAvailable ? 1u : 0u,
       .pWaitSemaphores = &imageAvailable,
       .pWaitDstStageMask = waitStages.data(),
       .commandBufferCount = 1,
       .pCommandBuffers = &cmdBuffer,
-      .signalSemaphoreCount = 1,
-      .pSignalSemaphores = &renderFinished,
+      .signalSemaphoreCount = signalCount,
+      .pSignalSemaphores = signalSemaphores.data(),
   }};
   if (vkQueueSubmit(
           device.graphicsQueue().queue,
@@ -685,4 +2083,10 @@ inline auto queueSubmit(
   }
 }
 
-}  // namespace vk
\ No newline at end of file
+}  // namespace vk
+
+template <> struct std::hash<vk::PipelineDesc> {
+  size_t operator()(vk::PipelineDesc const& desc) const {
+    return desc.hash();
+  }
+};
\ No newline at end of file